@@ -0,0 +1,101 @@
+#!/bin/sh
+# Macro-benchmarks: generated scripts run through oshell and, when they are
+# installed, dash and bash, in batch mode (script as argument) and pipe mode
+# (script on stdin). Prints CSV on stdout:
+#     workload,mode,shell,runs,best_ms,mean_ms
+#
+# usage: macro.sh OSHELL
+#
+# BENCH_RUNS (default 3) runs are timed per cell. BENCH_N (default 100000)
+# is the number of trivial commands; the other workloads scale from it.
+
+oshell=${1:?usage: macro.sh OSHELL}
+runs=${BENCH_RUNS:-3}
+n=${BENCH_N:-100000}
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/oshell-bench.XXXXXX") || exit 1
+trap 'rm -rf "$dir"' EXIT INT TERM
+
+now_ns() {
+    date +%s%N
+}
+
+# repeat COUNT LINE: LINE, COUNT times
+repeat() {
+    awk -v n="$1" -v line="$2" 'BEGIN { for (i = 0; i < n; i++) print line }'
+}
+
+# words COUNT PREFIX: PREFIX1 PREFIX2 ... on one line
+words() {
+    awk -v n="$1" -v p="$2" 'BEGIN {
+        for (i = 1; i <= n; i++) printf "%s%s%d", (i > 1 ? " " : ""), p, i
+        print ""
+    }'
+}
+
+# Builtin that every shell has, so only the shell's own overhead is timed
+repeat "$n" "cd ." > "$dir/trivial"
+
+# External commands, one launch each
+repeat $((n / 50)) "/bin/true" > "$dir/external"
+
+# Lines of 16 background commands. oshell waits for a line's jobs before the
+# next line; the POSIX shells get an explicit wait to do the same work.
+fan=$(words 16 "" | awk '{ for (i = 1; i <= NF; i++) printf "%s/bin/true", (i > 1 ? " & " : ""); print "" }')
+repeat $((n / 500)) "$fan" > "$dir/fanout"
+repeat $((n / 500)) "$fan; wait" > "$dir/fanout.posix"
+
+# Long argument lists
+args=$(words 2000 "arg")
+repeat $((n / 500)) "/bin/echo $args > /dev/null" > "$dir/longargs"
+
+# External commands under a large environment, which every launch passes on
+words 10000 "BENCH_VAR" | tr ' ' '\n' | awk '{ print $0 "=value_of_" $0 }' > "$dir/env.list"
+repeat $((n / 100)) "/bin/true" > "$dir/bigenv"
+
+# time_cell WORKLOAD MODE SHELL: run one cell BENCH_RUNS times, print its row
+time_cell() {
+    workload=$1 mode=$2 shell=$3
+    script="$dir/$workload"
+    if [ "$shell" != "$oshell" ] && [ -f "$script.posix" ]; then
+        script="$script.posix"
+    fi
+    set --
+    if [ "$workload" = bigenv ]; then
+        set -- env $(cat "$dir/env.list")
+    fi
+
+    best= total=0 i=0
+    while [ "$i" -lt "$runs" ]; do
+        start=$(now_ns)
+        if [ "$mode" = batch ]; then
+            "$@" "$shell" "$script" > /dev/null 2>&1
+        else
+            "$@" "$shell" < "$script" > /dev/null 2>&1
+        fi
+        elapsed=$(( $(now_ns) - start ))
+        total=$((total + elapsed))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+        fi
+        i=$((i + 1))
+    done
+
+    name=$(basename "$shell")
+    awk -v w="$workload" -v m="$mode" -v s="$name" -v r="$runs" -v b="$best" -v t="$total" \
+        'BEGIN { printf "%s,%s,%s,%d,%.2f,%.2f\n", w, m, s, r, b / 1e6, t / r / 1e6 }'
+}
+
+shells=$oshell
+for other in dash bash; do
+    path=$(command -v "$other") && shells="$shells $path"
+done
+
+echo "workload,mode,shell,runs,best_ms,mean_ms"
+for workload in trivial external fanout longargs bigenv; do
+    for mode in batch pipe; do
+        for shell in $shells; do
+            time_cell "$workload" "$mode" "$shell"
+        done
+    done
+done
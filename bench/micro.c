@@ -0,0 +1,234 @@
+// Micro-benchmarks of the shell's hot paths, linked against the shell's own
+// objects. Prints one CSV row per benchmark:
+//     benchmark,iterations,total_ns,ns_per_op
+// Iteration counts are multiplied by the optional argument (default 1), so
+// `micro 0.1` is a quick smoke run.
+#include "shell.h"
+#include "alias.h"
+#include "arena.h"
+#include "builtins.h"
+#include "jobs.h"
+#include "launch.h"
+#include "timing.h"
+#include "zygote.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#define ALIAS_COUNT 256
+#define BLOAT_BYTES (128u << 20)
+
+static double scale = 1.0;
+
+// Results are folded in here so the compiler cannot drop the work
+static volatile uintptr_t sink;
+
+static long iterations(long base) {
+    long n = (long)(base * scale);
+    return n > 0 ? n : 1;
+}
+
+static void report(const char *name, long n, uint64_t ns) {
+    printf("%s,%ld,%" PRIu64 ",%.1f\n", name, n, ns, (double)ns / n);
+    fflush(stdout);
+}
+
+static const char *bench_line =
+    "ls -l /tmp | grep -v foo && echo \"$HOME done\" > out.txt; true # note";
+
+static void bench_parse(void) {
+    size_t len = strlen(bench_line);
+    long n = iterations(200000);
+    uint64_t start = timing_now();
+    for (long i = 0; i < n; i++) {
+        command_list *cmds = parse_line(bench_line, len);
+        sink ^= (uintptr_t)cmds;
+        free_commands(cmds);
+    }
+    report("parse_line", n, timing_now() - start);
+
+    n = iterations(1000000);
+    start = timing_now();
+    for (long i = 0; i < n; i++) {
+        int error;
+        command_list *cmds = parse_line_cached(bench_line, len, &error);
+        sink ^= (uintptr_t)cmds;
+        free_commands(cmds);
+    }
+    report("parse_line_cached", n, timing_now() - start);
+}
+
+static void bench_expand(void) {
+    const char *line = "echo $HOME $? $$ \"a $USER b\" plain words here";
+    command_list *cmds = parse_line(line, strlen(line));
+    arena *mem = arena_create();
+    if (!cmds || !mem) return;
+
+    long n = iterations(500000);
+    uint64_t start = timing_now();
+    for (long i = 0; i < n; i++) {
+        sink ^= (uintptr_t)expand_command(mem, &cmds->cmds[0]);
+        arena_reset(mem);
+    }
+    report("expand_command", n, timing_now() - start);
+
+    arena_destroy(mem);
+    free_commands(cmds);
+}
+
+// A line of `count` words: the arguments of one command, or with `sep`
+// that many one-word commands joined by it
+static char *long_line(long count, const char *sep, size_t *len) {
+    size_t cap = (size_t)count * (16 + (sep ? strlen(sep) : 1)) + 16;
+    char *line = malloc(cap);
+    if (!line) return NULL;
+    size_t n = sep ? 0 : (size_t)snprintf(line, cap, "echo");
+    for (long i = 0; i < count; i++) {
+        n += snprintf(line + n, cap - n, "%sw%ld", !sep ? " " : i ? sep : "", i);
+    }
+    *len = n;
+    return line;
+}
+
+// Parsing and expanding lines of 10^5 and 2*10^5 arguments, and of as many
+// chained commands. ns_per_op is per word or command, so it stays flat
+// across sizes as long as both grow linearly.
+static void bench_scaling(void) {
+    static const long sizes[] = {100000, 200000};
+    for (int s = 0; s < 2; s++) {
+        long size = sizes[s];
+        size_t len;
+        char *line = long_line(size, NULL, &len);
+        arena *mem = arena_create();
+        if (!line || !mem) return;
+
+        long n = iterations(10);
+        uint64_t start = timing_now();
+        for (long i = 0; i < n; i++) {
+            command_list *cmds = parse_line(line, len);
+            if (cmds) sink ^= (uintptr_t)expand_command(mem, &cmds->cmds[0]);
+            free_commands(cmds);
+            arena_reset(mem);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "parse_expand_args_%ld", size);
+        report(name, n * size, timing_now() - start);
+        arena_destroy(mem);
+        free(line);
+
+        line = long_line(size, "; ", &len);
+        if (!line) return;
+        start = timing_now();
+        for (long i = 0; i < n; i++) {
+            command_list *cmds = parse_line(line, len);
+            sink ^= (uintptr_t)cmds;
+            free_commands(cmds);
+        }
+        snprintf(name, sizeof(name), "parse_commands_%ld", size);
+        report(name, n * size, timing_now() - start);
+        free(line);
+    }
+}
+
+static void bench_path(void) {
+    long n = iterations(2000000);
+    uint64_t start = timing_now();
+    for (long i = 0; i < n; i++) {
+        sink ^= (uintptr_t)find_in_path("ls");
+    }
+    report("find_in_path_hit", n, timing_now() - start);
+
+    // Misses are not remembered, so each one walks the path
+    n = iterations(50000);
+    start = timing_now();
+    for (long i = 0; i < n; i++) {
+        sink ^= (uintptr_t)find_in_path("no-such-command");
+    }
+    report("find_in_path_miss", n, timing_now() - start);
+}
+
+static void bench_alias(void) {
+    char names[ALIAS_COUNT][8];
+    for (int i = 0; i < ALIAS_COUNT; i++) {
+        snprintf(names[i], sizeof(names[i]), "a%d", i);
+        alias_set(names[i], "ls -l");
+    }
+
+    long n = iterations(2000000);
+    uint64_t start = timing_now();
+    for (long i = 0; i < n; i++) {
+        sink ^= (uintptr_t)find_alias(names[i & (ALIAS_COUNT - 1)]);
+    }
+    report("find_alias", n, timing_now() - start);
+    free_aliases();
+}
+
+static void bench_builtin(void) {
+    // Hits and misses, as for every command the shell runs
+    static const char *names[] = {"cd", "jobs", "ls", "grep"};
+    long n = iterations(5000000);
+    uint64_t start = timing_now();
+    for (long i = 0; i < n; i++) {
+        sink ^= (uintptr_t)find_builtin(names[i & 3]);
+    }
+    report("find_builtin", n, timing_now() - start);
+}
+
+static void bench_launch_with(const char *name, launch_backend backend, long base) {
+    command_list *cmds = parse_line("/bin/true", 9);
+    arena *mem = arena_create();
+    char **args = cmds && mem ? expand_command(mem, &cmds->cmds[0]) : NULL;
+    if (!args) return;
+
+    launch_set_backend(backend);
+    long n = iterations(base);
+    uint64_t start = timing_now();
+    for (long i = 0; i < n; i++) {
+        pid_t pid;
+        int status;
+        if (launch_command(&cmds->cmds[0], args, -1, -1, NULL, &pid) == 0) {
+            wait_child(pid, &status);
+        }
+    }
+    report(name, n, timing_now() - start);
+
+    arena_destroy(mem);
+    free_commands(cmds);
+}
+
+// Launch latency of each backend, first as the shell normally is and then
+// with a large resident heap, which fork has to copy page tables for. The
+// zygote is started while the process is still small, as the shell does.
+static void bench_launch(void) {
+    int zygote = zygote_start() == 0;
+    bench_launch_with("launch_spawn", LAUNCH_SPAWN, 2000);
+    bench_launch_with("launch_fork", LAUNCH_FORK, 2000);
+    if (zygote) bench_launch_with("launch_zygote", LAUNCH_ZYGOTE, 2000);
+
+    char *bloat = malloc(BLOAT_BYTES);
+    if (!bloat) return;
+    memset(bloat, 1, BLOAT_BYTES);
+    bench_launch_with("launch_spawn_128m_rss", LAUNCH_SPAWN, 500);
+    bench_launch_with("launch_fork_128m_rss", LAUNCH_FORK, 500);
+    if (zygote) bench_launch_with("launch_zygote_128m_rss", LAUNCH_ZYGOTE, 500);
+    free(bloat);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) scale = atof(argv[1]);
+    if (scale <= 0) scale = 1.0;
+
+    init_shell_state();
+    printf("benchmark,iterations,total_ns,ns_per_op\n");
+    bench_parse();
+    bench_expand();
+    bench_scaling();
+    bench_path();
+    bench_alias();
+    bench_builtin();
+    bench_launch();
+    free_shell_state();
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "oshell_client.h"
+#include "serve.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct oshell_session {
+    int fd;
+};
+
+static int send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+oshell_session *oshell_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return NULL;
+    strcpy(addr.sun_path, path);
+
+    oshell_session *s = malloc(sizeof(oshell_session));
+    if (!s) return NULL;
+    s->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s->fd < 0 || connect(s->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (s->fd >= 0) close(s->fd);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+// The request header, with our stdio attached unless output is captured
+static int send_request(oshell_session *s, const serve_request *req) {
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {(void *)req, sizeof(*req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (!(req->flags & SERVE_CAPTURE)) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    }
+
+    ssize_t n;
+    do {
+        n = sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == (ssize_t)sizeof(*req) ? 0 : -1;
+}
+
+int oshell_run(oshell_session *s, const char *line, oshell_output_fn output, void *arg) {
+    size_t len = strlen(line);
+    if (!s || s->fd < 0 || len > SERVE_MAX_LINE) return -1;
+
+    serve_request req = {output ? SERVE_CAPTURE : 0, (uint32_t)len};
+    if (send_request(s, &req) < 0 || send_all(s->fd, line, len) < 0) return -1;
+
+    char buf[SERVE_CHUNK];
+    serve_frame frame;
+    while (read_all(s->fd, &frame, sizeof(frame)) == 0) {
+        if (frame.type == SERVE_STATUS) {
+            int32_t status;
+            if (frame.len != sizeof(status) || read_all(s->fd, &status, sizeof(status)) < 0) {
+                break;
+            }
+            return status;
+        }
+        // Output, passed on in pieces as it arrives
+        while (frame.len > 0) {
+            size_t n = frame.len < sizeof(buf) ? frame.len : sizeof(buf);
+            if (read_all(s->fd, buf, n) < 0) return -1;
+            if (output) output((int)frame.type, buf, n, arg);
+            frame.len -= n;
+        }
+    }
+    return -1;
+}
+
+void oshell_close(oshell_session *s) {
+    if (!s) return;
+    if (s->fd >= 0) close(s->fd);
+    free(s);
+}
+
+int oshell_system(const char *path, const char *command) {
+    oshell_session *s = oshell_connect(path);
+    if (!s) return -1;
+    int status = oshell_run(s, command, NULL, NULL);
+    oshell_close(s);
+    return status;
+}
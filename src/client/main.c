@@ -0,0 +1,70 @@
+// oshell-client SOCKET [command ...]
+//
+// With a command, runs it (its words joined by spaces) through the server on
+// this process's stdio and exits with its status. Without one, runs each
+// line of stdin in a single session, writing the captured output to stdout
+// and stderr, and exits with the status of the last line.
+#include "oshell_client.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void write_output(int stream, const char *data, size_t len, void *arg) {
+    (void)arg;
+    fwrite(data, 1, len, stream == 2 ? stderr : stdout);
+}
+
+static char *join_words(int count, char **words) {
+    size_t len = 1;
+    for (int i = 0; i < count; i++) len += strlen(words[i]) + 1;
+    char *line = malloc(len);
+    if (!line) return NULL;
+    char *p = line;
+    for (int i = 0; i < count; i++) {
+        if (i > 0) *p++ = ' ';
+        size_t n = strlen(words[i]);
+        memcpy(p, words[i], n);
+        p += n;
+    }
+    *p = '\0';
+    return line;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: oshell-client SOCKET [command ...]\n");
+        return 2;
+    }
+
+    if (argc > 2) {
+        char *line = join_words(argc - 2, argv + 2);
+        int status = line ? oshell_system(argv[1], line) : -1;
+        free(line);
+        if (status < 0) {
+            fprintf(stderr, "oshell-client: cannot reach %s\n", argv[1]);
+            return 1;
+        }
+        return status;
+    }
+
+    oshell_session *s = oshell_connect(argv[1]);
+    if (!s) {
+        fprintf(stderr, "oshell-client: cannot reach %s\n", argv[1]);
+        return 1;
+    }
+    int status = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, stdin)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') line[len - 1] = '\0';
+        // The session is over after `exit`, with its status already in
+        int rc = oshell_run(s, line, write_output, NULL);
+        fflush(stdout);
+        if (rc < 0) break;
+        status = rc;
+    }
+    free(line);
+    oshell_close(s);
+    return status;
+}
@@ -0,0 +1,192 @@
+#include "../include/alias.h"
+#include "../include/arena.h"
+#include "../include/errors.h"
+#include "../include/stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIAS_TABLE_INITIAL 16
+
+// Name -> alias. Open addressing with linear probing; aliases are never
+// removed, so there are no tombstones.
+struct alias_store {
+    alias **table;
+    size_t table_cap;
+    size_t count;
+    alias *list;
+};
+
+static size_t hash_name(const char *name) {
+    size_t h = 5381;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h = h * 33 + *p;
+    }
+    return h;
+}
+
+static alias **alias_slot(alias **table, size_t cap, const char *name) {
+    size_t i = hash_name(name) & (cap - 1);
+    while (table[i] && strcmp(table[i]->name, name) != 0) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &table[i];
+}
+
+static int alias_grow(alias_store *as) {
+    size_t cap = as->table_cap ? as->table_cap * 2 : ALIAS_TABLE_INITIAL;
+    alias **table = calloc(cap, sizeof(alias *));
+    if (!table) return -1;
+    for (size_t i = 0; i < as->table_cap; i++) {
+        if (as->table[i]) {
+            *alias_slot(table, cap, as->table[i]->name) = as->table[i];
+        }
+    }
+    free(as->table);
+    as->table = table;
+    as->table_cap = cap;
+    return 0;
+}
+
+alias_store *alias_store_new(void) {
+    return calloc(1, sizeof(alias_store));
+}
+
+alias *find_alias(const char *name) {
+    alias_store *as = shell->aliases;
+    if (as->count == 0) return NULL;
+    return *alias_slot(as->table, as->table_cap, name);
+}
+
+int alias_set(const char *name, const char *value) {
+    alias_store *as = shell->aliases;
+    alias *a = find_alias(name);
+    if (a) {
+        char *copy = strdup(value);
+        if (!copy) return -1;
+        free(a->value);
+        a->value = copy;
+        // If the alias is running, its expansion still holds a reference
+        free_commands(a->body);
+        a->body = NULL;
+        a->body_error = 0;
+        return 0;
+    }
+
+    // Keep the load factor at or below one half
+    if ((as->count + 1) * 2 > as->table_cap && alias_grow(as) < 0) return -1;
+
+    a = calloc(1, sizeof(alias));
+    if (!a) return -1;
+    a->name = strdup(name);
+    a->value = strdup(value);
+    if (!a->name || !a->value) {
+        free(a->name);
+        free(a->value);
+        free(a);
+        return -1;
+    }
+    a->next = as->list;
+    as->list = a;
+    *alias_slot(as->table, as->table_cap, name) = a;
+    as->count++;
+    return 0;
+}
+
+void alias_print(const alias *a) {
+    fprintf(shell->out, "%s='%s'\n", a->name, a->value);
+}
+
+void alias_print_all(void) {
+    for (alias *a = shell->aliases->list; a; a = a->next) {
+        alias_print(a);
+    }
+}
+
+// Build the command list `name args...` runs: the alias body with the
+// caller's already expanded arguments appended, as literal words, to its
+// last command. Nothing is lexed again, so arguments keep their spaces and
+// $ signs. The result shares the body's words, so the body must outlive it;
+// release it with free_commands(). Returns NULL after reporting an error.
+command_list *alias_expand(alias *a, char **args) {
+    if (!a->body && !a->body_error) {
+        a->body = parse_line(a->value, strlen(a->value));
+        a->body_error = (a->body == NULL);
+    }
+    stats.alias_expansions++;
+
+    int nargs = 0;
+    while (args[nargs + 1]) nargs++;
+
+    const command_list *body = a->body;
+    if (!body && nargs == 0) {
+        print_error();
+        return NULL;
+    }
+
+    arena *mem = arena_acquire();
+    if (!mem) {
+        print_error();
+        return NULL;
+    }
+
+    // An empty body leaves the arguments to run as a command of their own
+    int count = body ? body->count : 1;
+    command_list *list = arena_alloc(mem, sizeof(command_list));
+    command *cmds = arena_calloc(mem, count + 1, sizeof(command));
+    if (!list || !cmds) {
+        arena_release(mem);
+        print_error();
+        return NULL;
+    }
+    if (body) memcpy(cmds, body->cmds, (count + 1) * sizeof(command));
+
+    command *last = &cmds[count - 1];
+    word *words = arena_alloc(mem, (last->argc + nargs + 1) * sizeof(word));
+    word_seg *segs = arena_alloc(mem, (nargs + 1) * sizeof(word_seg));
+    if (!words || !segs) {
+        arena_release(mem);
+        print_error();
+        return NULL;
+    }
+    if (last->argc > 0) memcpy(words, last->words, last->argc * sizeof(word));
+    for (int i = 0; i < nargs; i++) {
+        segs[i] = (word_seg){SEG_LITERAL, args[i + 1], strlen(args[i + 1])};
+        words[last->argc + i] = (word){&segs[i], 1};
+    }
+    last->words = words;
+    last->argc += nargs;
+
+    list->cmds = cmds;
+    list->count = count;
+    list->refs = 1;
+    list->mem = mem;
+    return list;
+}
+
+static void clear_aliases(alias_store *as) {
+    alias *a = as->list;
+    while (a) {
+        alias *next = a->next;
+        free(a->name);
+        free(a->value);
+        free_commands(a->body);
+        free(a);
+        a = next;
+    }
+    as->list = NULL;
+    free(as->table);
+    as->table = NULL;
+    as->table_cap = 0;
+    as->count = 0;
+}
+
+void free_aliases(void) {
+    clear_aliases(shell->aliases);
+}
+
+void alias_store_free(alias_store *as) {
+    if (!as) return;
+    clear_aliases(as);
+    free(as);
+}
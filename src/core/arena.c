@@ -0,0 +1,142 @@
+#include "../include/arena.h"
+#include "../include/shell.h"
+#include "../include/stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN (sizeof(max_align_t))
+#define ARENA_POOL_SIZE 8
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+} arena_block;
+
+struct arena {
+    arena_block *head;
+    arena_block *current;
+};
+
+static arena_block *block_new(size_t size) {
+    arena_block *b = malloc(sizeof(arena_block) + size);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+arena *arena_create(void) {
+    arena *a = malloc(sizeof(arena));
+    if (!a) return NULL;
+    a->head = block_new(ARENA_BLOCK_SIZE);
+    if (!a->head) {
+        free(a);
+        return NULL;
+    }
+    a->current = a->head;
+    return a;
+}
+
+void *arena_alloc(arena *a, size_t size) {
+    if (size == 0) size = 1;
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    // Walk forward through blocks kept from before the last reset
+    arena_block *b = a->current;
+    while (b->used + size > b->size) {
+        if (b->next == NULL) {
+            size_t bsize = b->size * 2;
+            if (bsize < size) bsize = size;
+            b->next = block_new(bsize);
+            if (!b->next) return NULL;
+        }
+        b = b->next;
+    }
+    a->current = b;
+    stats.allocations++;
+    stats.alloc_bytes += size;
+
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+void *arena_calloc(arena *a, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) return NULL;
+    void *p = arena_alloc(a, count * size);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+char *arena_strndup(arena *a, const char *str, size_t len) {
+    char *p = arena_alloc(a, len + 1);
+    if (!p) return NULL;
+    memcpy(p, str, len);
+    p[len] = '\0';
+    return p;
+}
+
+char *arena_strdup(arena *a, const char *str) {
+    return arena_strndup(a, str, strlen(str));
+}
+
+void arena_reset(arena *a) {
+    for (arena_block *b = a->head; b; b = b->next) {
+        b->used = 0;
+    }
+    a->current = a->head;
+}
+
+void arena_destroy(arena *a) {
+    if (!a) return;
+    arena_block *b = a->head;
+    while (b) {
+        arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    free(a);
+}
+
+// Arenas released with arena_release() are kept in the current context's
+// pool and handed out again by arena_acquire(), so steady-state parsing and
+// expansion do no malloc at all. More than one can be live at a time because
+// aliases parse and execute while their caller's line is still running.
+struct arena_pool {
+    arena *arenas[ARENA_POOL_SIZE];
+    int count;
+};
+
+arena_pool *arena_pool_new(void) {
+    return calloc(1, sizeof(arena_pool));
+}
+
+void arena_pool_free(arena_pool *pool) {
+    if (!pool) return;
+    for (int i = 0; i < pool->count; i++) arena_destroy(pool->arenas[i]);
+    free(pool);
+}
+
+arena *arena_acquire(void) {
+    arena_pool *pool = shell->arenas;
+    if (pool && pool->count > 0) {
+        return pool->arenas[--pool->count];
+    }
+    return arena_create();
+}
+
+void arena_release(arena *a) {
+    if (!a) return;
+    arena_pool *pool = shell->arenas;
+    if (pool && pool->count < ARENA_POOL_SIZE) {
+        arena_reset(a);
+        pool->arenas[pool->count++] = a;
+    } else {
+        arena_destroy(a);
+    }
+}
@@ -1,5 +1,12 @@
+#define _GNU_SOURCE
 #include "../include/shell.h"
 #include "../include/errors.h"
+#include "../include/jobs.h"
+#include "../include/launch.h"
+#include "../include/builtins.h"
+#include "../include/alias.h"
+#include "../include/vars.h"
+#include "../include/stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,79 +14,25 @@
 #include <limits.h>
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <signal.h>
 
-extern shell_state g_state;
-
-// ============= ALIAS SYSTEM =============
-typedef struct alias {
-    char *name;
-    char *value;
-    struct alias *next;
-} alias;
-
-static alias *alias_list = NULL;
-
-static void alias_add(const char *name, const char *value) {
-    alias *a = alias_list;
-    while (a) {
-        if (strcmp(a->name, name) == 0) {
-            free(a->value);
-            a->value = strdup(value);
-            return;
-        }
-        a = a->next;
-    }
-    
-    alias *new = malloc(sizeof(alias));
-    new->name = strdup(name);
-    new->value = strdup(value);
-    new->next = alias_list;
-    alias_list = new;
-}
-
-char *expand_alias(const char *name) {
-    alias *a = alias_list;
-    while (a) {
-        if (strcmp(a->name, name) == 0) {
-            return a->value;
-        }
-        a = a->next;
-    }
-    return NULL;
-}
-
-static void alias_print_one(const char *name) {
-    char *val = expand_alias(name);
-    if (val) {
-        printf("%s='%s'\n", name, val);
-    }
-}
-
-static void alias_print_all(void) {
-    alias *a = alias_list;
-    while (a) {
-        printf("%s='%s'\n", a->name, a->value);
-        a = a->next;
-    }
-}
-
-static void free_aliases(void) {
-    alias *a = alias_list;
-    while (a) {
-        alias *next = a->next;
-        free(a->name);
-        free(a->value);
-        free(a);
-        a = next;
+// ============= BUILTIN COMMANDS =============
+// The process's own context exits the process. Any other only stops: the
+// rest of its line is skipped and its caller sees it has exited.
+static int shell_exit(int status) {
+    shell->exit_status = status;
+    if (shell != &shell_process) {
+        shell->exited = 1;
+        return status;
     }
-    alias_list = NULL;
+    free_aliases();
+    exit(status);
 }
 
-// ============= BUILTIN COMMANDS =============
 static int builtin_exit(char **args) {
     if (args[1] == NULL) {
-        free_aliases();
-        exit(0);
+        return shell_exit(0);
     }
     
     char *endptr;
@@ -90,32 +43,54 @@ static int builtin_exit(char **args) {
         return 1;
     }
     
-    int status = (int)(val & 0xFF);
-    free_aliases();
-    exit(status);
+    return shell_exit((int)(val & 0xFF));
+}
+
+// Move the context to `target` and put its new path in cwd. The process's
+// own context changes the process's working directory; any other only
+// changes its own.
+static int change_dir(const char *target, char *cwd, size_t size) {
+    if (shell->cwd_fd == AT_FDCWD) {
+        if (chdir(target) != 0) return -1;
+        return getcwd(cwd, size) ? 0 : -1;
+    }
+
+    if (faccessat(shell->cwd_fd, target, X_OK, 0) != 0) return -1;
+    int fd = openat(shell->cwd_fd, target, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t n = readlink(link, cwd, size - 1);
+    if (n < 0) {
+        close(fd);
+        return -1;
+    }
+    cwd[n] = '\0';
+    close(shell->cwd_fd);
+    shell->cwd_fd = fd;
     return 0;
 }
 
 static int builtin_cd(char **args) {
     char *target = NULL;
-    char *old = g_state.pwd;
+    char *old = shell->pwd;
     int should_print = 0;
     
     if (args[1] == NULL) {
-        target = getenv("HOME");
+        target = (char *)vars_get("HOME");
         if (target == NULL) {
             print_error();
             return 1;
         }
     } else if (strcmp(args[1], "-") == 0) {
-        target = g_state.oldpwd;
+        target = shell->oldpwd;
         should_print = 1;
         if (target == NULL) {
             print_error();
             return 1;
         }
     } else if (strcmp(args[1], "--") == 0) {
-        target = g_state.oldpwd;
+        target = shell->oldpwd;
         if (target == NULL) {
             print_error();
             return 1;
@@ -124,24 +99,21 @@ static int builtin_cd(char **args) {
         target = args[1];
     }
 
-    if (chdir(target) != 0) {
+    char cwd[PATH_MAX];
+    if (change_dir(target, cwd, sizeof(cwd)) != 0) {
         print_error();
         return 1;
     }
 
-    free(g_state.oldpwd);
-    g_state.oldpwd = strdup(old);
+    free(shell->oldpwd);
+    shell->oldpwd = strdup(old);
     
-    free(g_state.pwd);
-    char cwd[PATH_MAX];
-    if (getcwd(cwd, sizeof(cwd)) == NULL) {
-        print_error();
-        return 1;
-    }
-    g_state.pwd = strdup(cwd);
+    free(shell->pwd);
+    shell->pwd = strdup(cwd);
+    command_hash_chdir();
     
     if (should_print) {
-        printf("%s\n", g_state.pwd);
+        fprintf(shell->out, "%s\n", shell->pwd);
     }
     
     return 0;
@@ -149,10 +121,7 @@ static int builtin_cd(char **args) {
 
 static int builtin_env(char **args) {
     (void)args;
-    extern char **environ;
-    for (char **env = environ; *env != NULL; env++) {
-        printf("%s\n", *env);
-    }
+    vars_print_exported();
     return 0;
 }
 
@@ -161,7 +130,7 @@ static int builtin_setenv(char **args) {
         print_error();
         return 1;
     }
-    if (setenv(args[1], args[2], 1) != 0) {
+    if (vars_set(args[1], args[2], 1) != 0) {
         print_error();
         return 1;
     }
@@ -173,7 +142,7 @@ static int builtin_unsetenv(char **args) {
         print_error();
         return 1;
     }
-    unsetenv(args[1]);
+    vars_unset(args[1]);
     return 0;
 }
 
@@ -195,69 +164,259 @@ static int builtin_alias(char **args) {
                 char *unquoted = malloc(len - 1);
                 strncpy(unquoted, value + 1, len - 2);
                 unquoted[len - 2] = '\0';
-                alias_add(name, unquoted);
+                alias_set(name, unquoted);
                 free(unquoted);
             } else {
-                alias_add(name, value);
+                alias_set(name, value);
             }
         } else {
-            alias_print_one(args[i]);
+            alias *a = find_alias(args[i]);
+            if (a) alias_print(a);
         }
     }
     return 0;
 }
 
 static int builtin_path(char **args) {
-    for (int i = 0; i < g_state.path_count; i++) {
-        free(g_state.path_list[i]);
+    for (int i = 0; i < shell->path_count; i++) {
+        free(shell->path_list[i]);
     }
-    free(g_state.path_list);
+    free(shell->path_list);
 
     int new_count = 0;
     for (int i = 1; args[i]; i++) {
         new_count++;
     }
 
-    g_state.path_count = new_count;
+    shell->path_count = new_count;
     if (new_count == 0) {
-        g_state.path_list = NULL;
+        shell->path_list = NULL;
     } else {
-        g_state.path_list = malloc((new_count + 1) * sizeof(char *));
+        shell->path_list = malloc((new_count + 1) * sizeof(char *));
         for (int i = 0; i < new_count; i++) {
-            g_state.path_list[i] = strdup(args[i + 1]);
+            shell->path_list[i] = strdup(args[i + 1]);
+        }
+        shell->path_list[new_count] = NULL;
+    }
+
+    // Resolved paths may no longer be what a search would find
+    command_hash_clear();
+    return 0;
+}
+
+static int builtin_hash(char **args) {
+    if (args[1] == NULL) {
+        command_hash_print();
+        return 0;
+    }
+
+    if (strcmp(args[1], "-r") == 0) {
+        command_hash_clear();
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; args[i]; i++) {
+        if (is_builtin(args[i]) || find_alias(args[i])) continue;
+        if (find_in_path(args[i]) == NULL) {
+            print_error();
+            status = 1;
+        }
+    }
+    return status;
+}
+
+static int builtin_jobs(char **args) {
+    if (args[1] == NULL) {
+        jobs_print();
+        return 0;
+    }
+
+    if (strcmp(args[1], "-j") != 0 || (args[2] != NULL && args[3] != NULL)) {
+        print_error();
+        return 1;
+    }
+
+    if (args[2] == NULL) {
+        fprintf(shell->out, "%d\n", jobs_get_limit());
+        return 0;
+    }
+
+    char *endptr;
+    long limit = strtol(args[2], &endptr, 10);
+    if (*endptr != '\0' || endptr == args[2] || limit < 1 || limit > INT_MAX) {
+        print_error();
+        return 1;
+    }
+    jobs_set_limit((int)limit);
+    return 0;
+}
+
+// A job given as %N, %%, or a pid of one of its processes
+static job *find_job(const char *arg) {
+    if (*arg == '%') return jobs_find(arg, 0);
+    char *endptr;
+    long pid = strtol(arg, &endptr, 10);
+    if (*endptr != '\0' || endptr == arg || pid <= 0) return NULL;
+    return jobs_find_pid((pid_t)pid);
+}
+
+static int builtin_wait(char **args) {
+    if (args[1] == NULL) {
+        return jobs_wait_all();
+    }
+
+    // The status is that of the last job waited for
+    int status = 0;
+    for (int i = 1; args[i]; i++) {
+        job *j = find_job(args[i]);
+        if (!j) {
+            print_error();
+            status = 127;
+            continue;
         }
-        g_state.path_list[new_count] = NULL;
+        status = jobs_wait(j);
+        if (status == 130) break;
     }
+    return status;
+}
+
+static int builtin_fg(char **args) {
+    job *j = args[1] ? jobs_find(args[1], 1) : jobs_current(0);
+    if (!j || (args[1] && args[2])) {
+        print_error();
+        return 1;
+    }
+    return jobs_foreground(j);
+}
+
+static int builtin_bg(char **args) {
+    if (args[1] == NULL) {
+        job *j = jobs_current(1);
+        if (!j) {
+            print_error();
+            return 1;
+        }
+        return jobs_background(j);
+    }
+
+    int status = 0;
+    for (int i = 1; args[i]; i++) {
+        job *j = jobs_find(args[i], 1);
+        if (!j || jobs_background(j) != 0) {
+            print_error();
+            status = 1;
+        }
+    }
+    return status;
+}
+
+static const struct {
+    const char *name;
+    int signo;
+} signal_names[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},
+    {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
+    {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU},
+};
+
+// -N, -NAME or -SIGNAME; returns -1 if it is none of them
+static int parse_signal(const char *arg) {
+    char *endptr;
+    long signo = strtol(arg, &endptr, 10);
+    if (*endptr == '\0' && endptr != arg) {
+        return signo >= 0 && signo < NSIG ? (int)signo : -1;
+    }
+    if (strncmp(arg, "SIG", 3) == 0) arg += 3;
+    for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); i++) {
+        if (strcmp(arg, signal_names[i].name) == 0) return signal_names[i].signo;
+    }
+    return -1;
+}
 
+static int builtin_kill(char **args) {
+    int signo = SIGTERM;
+    int i = 1;
+    if (args[1] && args[1][0] == '-') {
+        signo = parse_signal(args[1] + 1);
+        i = 2;
+    }
+    if (signo < 0 || args[i] == NULL) {
+        print_error();
+        return 1;
+    }
+
+    // Jobs are signalled as a whole; anything else is a pid
+    int status = 0;
+    for (; args[i]; i++) {
+        int rc;
+        if (args[i][0] == '%') {
+            job *j = jobs_find(args[i], 0);
+            rc = j ? jobs_signal(j, signo) : -1;
+        } else {
+            char *endptr;
+            long pid = strtol(args[i], &endptr, 10);
+            rc = (*endptr != '\0' || endptr == args[i]) ? -1 : kill((pid_t)pid, signo);
+        }
+        if (rc < 0) {
+            print_error();
+            status = 1;
+        }
+    }
+    return status;
+}
+
+static int builtin_stats(char **args) {
+    if (args[1] == NULL) {
+        stats_print(shell->out);
+        return 0;
+    }
+
+    if (strcmp(args[1], "-r") != 0 || args[2] != NULL) {
+        print_error();
+        return 1;
+    }
+    stats_reset();
     return 0;
 }
 
 // ============= MAN BUILTIN =============
+// Manual pages beyond the builtins' own
+static const char *extra_manpages[] = {"oshell", "builtins", NULL};
+
+static void print_manpages(void);
+
+// fopen() in the context's working directory
+static FILE *open_relative(const char *path) {
+    int fd = openat(shell->cwd_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    FILE *fp = fdopen(fd, "r");
+    if (!fp) close(fd);
+    return fp;
+}
+
 static int builtin_man(char **args) {
     if (args[1] == NULL) {
-        printf("Usage: man [command]\n");
-        printf("Available commands: exit, cd, env, setenv, unsetenv, alias, path, oshell, builtins\n");
+        fprintf(shell->out, "Usage: man [command]\n");
+        fprintf(shell->out, "Available commands: ");
+        print_manpages();
         return 0;
     }
     
     char *manpage = args[1];
-    char *manpages[] = {
-        "exit", "cd", "env", "setenv", "unsetenv", 
-        "alias", "path", "oshell", "builtins", NULL
-    };
     
     // Check if valid man page
-    int valid = 0;
-    for (int i = 0; manpages[i]; i++) {
-        if (strcmp(manpage, manpages[i]) == 0) {
-            valid = 1;
-            break;
-        }
+    const builtin *b = find_builtin(manpage);
+    int valid = b && !(b->flags & BUILTIN_NO_MAN);
+    for (int i = 0; !valid && extra_manpages[i]; i++) {
+        valid = strcmp(manpage, extra_manpages[i]) == 0;
     }
     
     if (!valid) {
-        printf("No manual entry for '%s'\n", manpage);
-        printf("Available: exit, cd, env, setenv, unsetenv, alias, path, oshell, builtins\n");
+        fprintf(shell->out, "No manual entry for '%s'\n", manpage);
+        fprintf(shell->out, "Available: ");
+        print_manpages();
         return 1;
     }
     
@@ -265,15 +424,15 @@ static int builtin_man(char **args) {
     char path[256];
     snprintf(path, sizeof(path), "man/%s.1", manpage);
     
-    FILE *fp = fopen(path, "r");
+    FILE *fp = open_relative(path);
     if (fp == NULL) {
         // Try from parent directory (if running from src/)
         snprintf(path, sizeof(path), "../man/%s.1", manpage);
-        fp = fopen(path, "r");
+        fp = open_relative(path);
     }
     
     if (fp == NULL) {
-        printf("Cannot open manual page '%s.1'\n", manpage);
+        fprintf(shell->out, "Cannot open manual page '%s.1'\n", manpage);
         return 1;
     }
     
@@ -287,50 +446,66 @@ static int builtin_man(char **args) {
         // Skip troff commands
         if (line[0] == '.') {
             if (strncmp(line, ".SH", 3) == 0) {
-                printf("\n\033[1m%s\033[0m\n", line + 4);
-                printf("========================================\n");
+                fprintf(shell->out, "\n\033[1m%s\033[0m\n", line + 4);
+                fprintf(shell->out, "========================================\n");
             } else if (strncmp(line, ".TP", 3) == 0) {
-                printf("  ");
+                fprintf(shell->out, "  ");
             } else if (strncmp(line, ".B", 2) == 0) {
-                printf("\033[1m%s\033[0m ", line + 3);
+                fprintf(shell->out, "\033[1m%s\033[0m ", line + 3);
             } else if (strncmp(line, ".I", 2) == 0) {
-                printf("\033[3m%s\033[0m ", line + 3);
+                fprintf(shell->out, "\033[3m%s\033[0m ", line + 3);
             } else if (strncmp(line, ".TH", 3) == 0) {
                 // Skip title header
             } else if (strncmp(line, ".fi", 3) == 0) {
-                printf("\n");
+                fprintf(shell->out, "\n");
             } else if (strncmp(line, ".nf", 3) == 0) {
-                printf("\n");
+                fprintf(shell->out, "\n");
             }
         } else {
             // Regular text
-            printf("%s\n", line);
+            fprintf(shell->out, "%s\n", line);
         }
     }
     
     fclose(fp);
-    printf("\n");
+    fprintf(shell->out, "\n");
     return 0;
 }
 
+static const builtin builtin_table[] = {
+#define BUILTIN(name, flags) {#name, builtin_##name, flags},
+#include "../include/builtins.def"
+#undef BUILTIN
+};
+
+#define BUILTIN_COUNT ((int)(sizeof(builtin_table) / sizeof(builtin_table[0])))
+
+#include "builtin_hash.h"
+
+const builtin *find_builtin(const char *name) {
+    int idx = builtin_slots[builtin_name_hash(name, BUILTIN_HASH_SEED) & (BUILTIN_HASH_SIZE - 1)];
+    if (idx < 0 || strcmp(builtin_table[idx].name, name) != 0) return NULL;
+    return &builtin_table[idx];
+}
+
+static void print_manpages(void) {
+    const char *sep = "";
+    for (int i = 0; i < BUILTIN_COUNT; i++) {
+        if (builtin_table[i].flags & BUILTIN_NO_MAN) continue;
+        fprintf(shell->out, "%s%s", sep, builtin_table[i].name);
+        sep = ", ";
+    }
+    for (int i = 0; extra_manpages[i]; i++) fprintf(shell->out, ", %s", extra_manpages[i]);
+    fprintf(shell->out, "\n");
+}
+
+int is_builtin(const char *name) {
+    return find_builtin(name) != NULL;
+}
+
 // Main builtin dispatcher
 int execute_builtin(char **args) {
-    if (strcmp(args[0], "exit") == 0) {
-        return builtin_exit(args);
-    } else if (strcmp(args[0], "cd") == 0) {
-        return builtin_cd(args);
-    } else if (strcmp(args[0], "env") == 0) {
-        return builtin_env(args);
-    } else if (strcmp(args[0], "setenv") == 0) {
-        return builtin_setenv(args);
-    } else if (strcmp(args[0], "unsetenv") == 0) {
-        return builtin_unsetenv(args);
-    } else if (strcmp(args[0], "alias") == 0) {
-        return builtin_alias(args);
-    } else if (strcmp(args[0], "path") == 0) {
-        return builtin_path(args);
-    } else if (strcmp(args[0], "man") == 0) {
-        return builtin_man(args);
-    }
-    return -1;  // Not a builtin
+    const builtin *b = find_builtin(args[0]);
+    if (!b) return -1;  // Not a builtin
+    return b->handler(args);
 }
@@ -1,5 +1,19 @@
+#include "../include/shell.h"
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ERROR_MESSAGE "An error has occurred\n"
 
 void print_error(void) {
-    fprintf(stderr, "An error has occurred\n");
+    // Library code may fail before any context has been set up
+    fprintf(shell->err ? shell->err : stderr, ERROR_MESSAGE);
+}
+
+void print_error_fd(int fd) {
+    if (fd == shell->fds[2]) {
+        print_error();
+        return;
+    }
+    write(fd, ERROR_MESSAGE, strlen(ERROR_MESSAGE));
 }
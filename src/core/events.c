@@ -0,0 +1,119 @@
+#include "../include/events.h"
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+// The event loop of the process's own context; library contexts wait on
+// their children's pidfds instead and never touch it
+static int epoll_fd = -1;
+static int sigchld_fd = -1;
+static int sigint_fd = -1;
+static int input_fd = -1;
+
+// Signal mask the shell started with; what launched commands get back. Set
+// on the thread that runs events_init(); contexts on other threads, which
+// never do, launch with an empty mask.
+static _Thread_local sigset_t child_mask;
+
+static int add_fd(int fd) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int signal_fd(int sig) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, sig);
+    return signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+// Must run before the first child is started, or its SIGCHLD could be lost
+int events_init(int catch_interrupts) {
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    if (catch_interrupts) sigaddset(&block, SIGINT);
+
+    sigset_t old;
+    if (sigprocmask(SIG_BLOCK, &block, &old) < 0) return -1;
+    if (epoll_fd < 0) {
+        child_mask = old;
+        sigdelset(&child_mask, SIGCHLD);
+        sigdelset(&child_mask, SIGINT);
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    sigchld_fd = signal_fd(SIGCHLD);
+    if (epoll_fd < 0 || sigchld_fd < 0 || add_fd(sigchld_fd) < 0) return -1;
+    if (catch_interrupts) {
+        sigint_fd = signal_fd(SIGINT);
+        if (sigint_fd < 0 || add_fd(sigint_fd) < 0) return -1;
+    }
+    return 0;
+}
+
+// A forked copy of the shell must not share the parent's epoll instance.
+// It keeps reaping its own children the same way, but lets SIGINT kill it
+// and job control signals stop it.
+void events_child_reset(void) {
+    if (epoll_fd >= 0) close(epoll_fd);
+    if (sigchld_fd >= 0) close(sigchld_fd);
+    if (sigint_fd >= 0) close(sigint_fd);
+    epoll_fd = sigchld_fd = sigint_fd = input_fd = -1;
+
+    struct sigaction sa;
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+
+    sigprocmask(SIG_SETMASK, &child_mask, NULL);
+
+    events_init(0);
+}
+
+const sigset_t *events_child_mask(void) {
+    return &child_mask;
+}
+
+static void drain(int fd) {
+    struct signalfd_siginfo info[16];
+    while (read(fd, info, sizeof(info)) > 0) {
+    }
+}
+
+// Wait up to `timeout_ms` (-1: forever) for a child to exit, an interrupt,
+// or `fd` (-1: none) to become readable. Returns the EVENT_* flags that
+// fired, 0 on timeout, or -1 on error. Signals are consumed; after
+// EVENT_CHILD the caller must reap every child that has exited.
+int events_wait(int fd, int timeout_ms) {
+    if (fd != input_fd) {
+        if (input_fd >= 0) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, input_fd, NULL);
+        input_fd = -1;
+        if (fd >= 0 && add_fd(fd) == 0) input_fd = fd;
+    }
+
+    struct epoll_event evs[3];
+    int n;
+    do {
+        n = epoll_wait(epoll_fd, evs, 3, timeout_ms);
+    } while (n < 0 && timeout_ms != 0 && errno == EINTR);
+    if (n < 0) return -1;
+
+    int flags = 0;
+    for (int i = 0; i < n; i++) {
+        if (evs[i].data.fd == sigchld_fd) {
+            drain(sigchld_fd);
+            flags |= EVENT_CHILD;
+        } else if (evs[i].data.fd == sigint_fd) {
+            drain(sigint_fd);
+            flags |= EVENT_INTERRUPT;
+        } else {
+            flags |= EVENT_INPUT;
+        }
+    }
+    return flags;
+}
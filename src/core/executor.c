@@ -1,39 +1,28 @@
+#define _GNU_SOURCE
 #include "../include/shell.h"
 #include "../include/errors.h"
+#include "../include/arena.h"
+#include "../include/jobs.h"
+#include "../include/launch.h"
+#include "../include/events.h"
+#include "../include/alias.h"
+#include "../include/vars.h"
+#include "../include/timing.h"
+#include "../include/trace.h"
+#include "../include/stats.h"
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <stdio.h>
-#include <signal.h>
-#include <time.h>
-
-extern shell_state g_state;
-
-void free_commands(command *cmds) {
-    if (!cmds) return;
-    
-    for (int i = 0; cmds[i].args != NULL || cmds[i].redir_file != NULL; i++) {
-        if (cmds[i].args) {
-            for (int j = 0; cmds[i].args[j] != NULL; j++) {
-                free(cmds[i].args[j]);
-            }
-            free(cmds[i].args);
-        }
-        if (cmds[i].redir_file) {
-            free(cmds[i].redir_file);
-        }
-    }
-    free(cmds);
-}
 
 static int do_redirection(command *cmd) {
     if (cmd->redir_type == REDIR_NONE || cmd->redir_file == NULL) {
         return 0;
     }
     
-    int fd = open(cmd->redir_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int fd = openat(shell->cwd_fd, cmd->redir_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     if (fd < 0) {
         print_error();
         return -1;
@@ -51,260 +40,385 @@ static int do_redirection(command *cmd) {
     return 0;
 }
 
-static char *find_in_path(char *cmd) {
-    if (strchr(cmd, '/') != NULL) {
-        if (access(cmd, X_OK) == 0) return strdup(cmd);
-        return NULL;
-    }
+// The shell's stdout and stderr while an in-shell command has them
+// redirected
+typedef struct saved_fds {
+    FILE *file; // the redirection, NULL if there is none
+    int out_fd;
+    int err_fd;
+    FILE *out;
+    FILE *err;
+} saved_fds;
 
-    for (int i = 0; i < g_state.path_count; i++) {
-        char *path = g_state.path_list[i];
-        size_t len = strlen(path) + strlen(cmd) + 2;
-        char *full = malloc(len);
-        snprintf(full, len, "%s/%s", path, cmd);
-        if (access(full, X_OK) == 0) return full;
-        free(full);
+// Apply a command's redirection to the shell itself, for builtins and
+// aliases, which run without a fork: the context's stdout and stderr point
+// at the file until restore_fds(), and commands it launches meanwhile get
+// it too. The process's own descriptors are not touched. Returns 0, or -1
+// after reporting an error.
+static int redirect_in_shell(command *cmd, saved_fds *saved) {
+    saved->file = NULL;
+    if (cmd->redir_type == REDIR_NONE || cmd->redir_file == NULL) {
+        return 0;
     }
-    return NULL;
-}
 
-// NEW: Function to execute alias by parsing it as a new command line
-static int execute_alias(const char *alias_value, char **original_args) {
-    // Create a command line from alias value + remaining arguments
-    char *line = malloc(strlen(alias_value) + 1024); // Extra space for args
-    if (!line) {
-        print_error();
-        return 1;
-    }
-    
-    // Start with alias value
-    strcpy(line, alias_value);
-    
-    // Append original arguments (skip the alias name itself)
-    int has_space = (strlen(alias_value) > 0 && alias_value[strlen(alias_value)-1] != ' ');
-    for (int i = 1; original_args[i] != NULL; i++) {
-        if (has_space) {
-            strcat(line, " ");
-            has_space = 0;
-        }
-        strcat(line, original_args[i]);
-        has_space = 1;
-    }
-    
-    // Parse and execute the line
-    command *cmds = parse_line(line);
-    free(line);
-    
-    if (!cmds) {
+    int fd = openat(shell->cwd_fd, cmd->redir_file,
+                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!file) {
+        if (fd >= 0) close(fd);
         print_error();
-        return 1;
+        return -1;
     }
-    
+
+    // Whatever is buffered belongs to the old stdout and stderr
+    fflush(shell->out);
+    fflush(shell->err);
+    saved->file = file;
+    saved->out_fd = shell->fds[1];
+    saved->err_fd = shell->fds[2];
+    saved->out = shell->out;
+    saved->err = shell->err;
+    shell->fds[1] = shell->fds[2] = fd;
+    shell->out = shell->err = file;
+    return 0;
+}
+
+static void restore_fds(saved_fds *saved) {
+    if (!saved->file) return;
+    fclose(saved->file);
+    shell->fds[1] = saved->out_fd;
+    shell->fds[2] = saved->err_fd;
+    shell->out = saved->out;
+    shell->err = saved->err;
+}
+
+// Run an alias: its parsed body with the caller's arguments spliced in
+static int execute_alias(alias *a, char **args) {
+    command_list *cmds = alias_expand(a, args);
+    if (!cmds) return 1;
+
+    // Keep the body alive even if the alias redefines itself while it runs
+    command_list *body = a->body;
+    if (body) body->refs++;
+
+    a->active = 1;
     int result = execute_sequence(cmds);
+    a->active = 0;
+
     free_commands(cmds);
+    free_commands(body);
     return result;
 }
 
-static int execute_single_command(command *cmd) {
-    if (cmd == NULL || cmd->args == NULL || cmd->args[0] == NULL) {
+// The alias `name` runs as, unless it is already running
+static alias *lookup_alias(const char *name) {
+    alias *a = find_alias(name);
+    return a && !a->active ? a : NULL;
+}
+
+static int execute_single_command(command *cmd, char **args) {
+    if (cmd == NULL || args == NULL || args[0] == NULL) {
         return 0;
     }
 
-    // Check for alias BEFORE builtin
-    char *alias_value = expand_alias(cmd->args[0]);
-    if (alias_value) {
-        // Execute alias by parsing it as a new command line
-        int result = execute_alias(alias_value, cmd->args);
-        g_state.exit_status = result;
+    // Aliases and builtins run in the shell itself, redirection included;
+    // check for alias BEFORE builtin
+    uint64_t start = tracing ? timing_now() : 0;
+    alias *a = lookup_alias(args[0]);
+    if (a || is_builtin(args[0])) {
+        saved_fds saved;
+        int result = 1;
+        if (redirect_in_shell(cmd, &saved) == 0) {
+            if (!a) stats.builtins++;
+            result = a ? execute_alias(a, args) : execute_builtin(args);
+            restore_fds(&saved);
+        }
+        // An alias's own commands are traced as they run
+        if (tracing && !a) trace_finished(args[0], result, start);
+        shell->exit_status = result;
         return result;
     }
 
-    int builtin_result = execute_builtin(cmd->args);
-    if (builtin_result != -1) {
-        g_state.exit_status = builtin_result;
-        return builtin_result;
+    // Under job control the command is a foreground job of its own
+    process_group group = {0, 1};
+    const process_group *g = jobs_terminal() >= 0 ? &group : NULL;
+    pid_t pid;
+    int launch_status = launch_command(cmd, args, -1, -1, g, &pid);
+    if (launch_status != 0) {
+        shell->exit_status = launch_status;
+        return launch_status;
+    } else {
+        int status = 0;
+        wait_child(pid, &status);
+        jobs_take_terminal();
+        
+        if (WIFSTOPPED(status)) {
+            int result = 1;
+            shell->exit_status = jobs_stopped(&args, 1, &pid, &result, status);
+            return shell->exit_status;
+        }
+        if (WIFEXITED(status)) {
+            shell->exit_status = WEXITSTATUS(status);
+            return shell->exit_status;
+        }
+        
+        shell->exit_status = 1;
+        return 1;
     }
+}
 
-    sigset_t block_mask, old_mask;
-    sigemptyset(&block_mask);
-    sigaddset(&block_mask, SIGINT);
-    sigprocmask(SIG_BLOCK, &block_mask, &old_mask);
-    
+// Run a builtin, alias or empty command as a pipeline stage in a forked copy
+// of the shell. `spare_fd` is the read end of this stage's own output pipe,
+// which the child must not keep open.
+static pid_t fork_stage(command *cmd, char **args, int in_fd, int out_fd,
+                        int spare_fd, const process_group *group) {
+    // Otherwise output still buffered in the shell would be written twice
+    fflush(shell->out);
     pid_t pid = fork();
-    if (pid == -1) {
+    if (pid != 0) {
+        if (pid > 0) stats.forks++;
+        if (pid > 0 && group) setpgid(pid, group->pgid ? group->pgid : pid);
+        return pid;
+    }
+
+    // Into the job's process group while stop signals are still blocked,
+    // as launch_command() does for external commands
+    if (group) {
+        setpgid(0, group->pgid);
+        if (group->foreground) tcsetpgrp(jobs_terminal(), getpgrp());
+    }
+
+    // The child must not read ahead of the parent's input or wait for the
+    // parent's jobs, and gets its own event loop with SIGINT back to default
+    jobs_child_reset();
+
+    // Pipe ends are close-on-exec, but this child never execs. Without one
+    // the stage has the context's stdio, which becomes the child's own.
+    int fds[3] = {in_fd >= 0 ? in_fd : shell->fds[0],
+                  out_fd >= 0 ? out_fd : shell->fds[1],
+                  shell->fds[2]};
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != i && dup2(fds[i], i) < 0) _exit(1);
+    }
+    if (in_fd >= 0) close(in_fd);
+    if (out_fd >= 0) close(out_fd);
+    if (spare_fd >= 0) close(spare_fd);
+    shell_use_stdio();
+
+    if (do_redirection(cmd) < 0) _exit(1);
+
+    int status = 0;
+    if (args[0] != NULL) {
+        alias *a = lookup_alias(args[0]);
+        status = a ? execute_alias(a, args) : execute_builtin(args);
+    }
+    fflush(shell->out);
+    trace_close();
+    _exit(status);
+}
+
+// Start one pipeline stage without waiting. Returns 0 with *pid set, or the
+// stage's exit status if it could not be started.
+static int start_stage(command *cmd, char **args, int in_fd, int out_fd, int spare_fd,
+                       const process_group *group, pid_t *pid) {
+    // External commands are launched directly; only aliases and builtins
+    // need a forked copy of the shell to run in
+    if (args[0] && !lookup_alias(args[0]) && !is_builtin(args[0])) {
+        return launch_command(cmd, args, in_fd, out_fd, group, pid);
+    }
+    uint64_t start = phase_start();
+    uint64_t spawn_ns = tracing ? timing_now() : 0;
+    *pid = fork_stage(cmd, args, in_fd, out_fd, spare_fd, group);
+    phase_end(PHASE_LAUNCH, start);
+    if (tracing && *pid > 0) {
+        trace_launched(*pid, args[0] ? args[0] : "", 0, spawn_ns, timing_now());
+    }
+    if (*pid < 0) {
         print_error();
-        sigprocmask(SIG_SETMASK, &old_mask, NULL);
-        g_state.exit_status = 1;
         return 1;
     }
+    return 0;
+}
 
-    if (pid == 0) {
-        sigprocmask(SIG_SETMASK, &old_mask, NULL);
-        
-        struct sigaction sa;
-        sa.sa_handler = SIG_DFL;
-        sigemptyset(&sa.sa_mask);
-        sa.sa_flags = 0;
-        sigaction(SIGINT, &sa, NULL);
-        
-        if (do_redirection(cmd) < 0) _exit(1);
-        
-        char *cmd_path = find_in_path(cmd->args[0]);
-        if (cmd_path == NULL) {
+// Start every stage of a pipeline. Under job control the stages form one
+// process group, led by the first one started, which gets the terminal if
+// the pipeline runs in the `foreground`.
+int start_pipeline(command *cmds, char ***argv, int nstages, pid_t *pids, int *statuses,
+                   int foreground) {
+    process_group group = {0, foreground};
+    const process_group *g = jobs_terminal() >= 0 ? &group : NULL;
+    int live = 0;
+    int in_fd = -1;
+    for (int k = 0; k < nstages; k++) {
+        int pipefd[2] = {-1, -1};
+        pids[k] = -1;
+
+        if (k < nstages - 1 && pipe2(pipefd, O_CLOEXEC) < 0) {
             print_error();
-            _exit(127);
+            statuses[k] = 1;
+        } else {
+            statuses[k] = start_stage(&cmds[k], argv[k], in_fd, pipefd[1], pipefd[0],
+                                      g, &pids[k]);
+            if (statuses[k] == 0) {
+                live++;
+                if (group.pgid == 0) {
+                    group.pgid = pids[k];
+                    group.foreground = 0;
+                }
+            } else {
+                pids[k] = -1;
+            }
         }
-        
-        execv(cmd_path, cmd->args);
+
+        if (in_fd >= 0) close(in_fd);
+        if (pipefd[1] >= 0) close(pipefd[1]);
+        in_fd = pipefd[0];
+    }
+    return live;
+}
+
+static int pipefail_enabled(void) {
+    const char *value = vars_get("OSHELL_PIPEFAIL");
+    return value && *value && strcmp(value, "0") != 0;
+}
+
+// Expand every stage of cmds[0..nstages-1] up front, in order
+static char ***expand_stages(arena *mem, command *cmds, int nstages) {
+    char ***argv = arena_alloc(mem, nstages * sizeof(char **));
+    if (!argv) return NULL;
+    for (int k = 0; k < nstages; k++) {
+        argv[k] = expand_command(mem, &cmds[k]);
+        if (!argv[k]) return NULL;
+    }
+    return argv;
+}
+
+// Run cmds[0..nstages-1], joined by pipes, in the foreground. Every stage is
+// started before any is waited for. The status is the last stage's, or with
+// OSHELL_PIPEFAIL set the rightmost non-zero one. Under job control the
+// pipeline becomes a stopped job if it is stopped.
+static int execute_pipeline(command *cmds, int nstages, char ***argv, arena *mem) {
+    pid_t *pids = arena_alloc(mem, nstages * sizeof(pid_t));
+    int *statuses = arena_alloc(mem, nstages * sizeof(int));
+    if (!pids || !statuses) {
         print_error();
-        _exit(126);
-    } else {
-        int status;
-        waitpid(pid, &status, 0);
-        
-        sigset_t pending;
-        sigpending(&pending);
-        if (sigismember(&pending, SIGINT)) {
-            siginfo_t info;
-            struct timespec timeout = {0, 0};
-            sigtimedwait(&block_mask, &info, &timeout);
+        return 1;
+    }
+
+    int live = start_pipeline(cmds, argv, nstages, pids, statuses, 1);
+    while (live > 0) {
+        int wstatus = 0;
+        pid_t pid = wait_any_child(pids, nstages, &wstatus);
+        if (pid < 0) break;
+        if (WIFSTOPPED(wstatus)) {
+            jobs_take_terminal();
+            shell->exit_status = jobs_stopped(argv, nstages, pids, statuses, wstatus);
+            return shell->exit_status;
         }
-        
-        sigprocmask(SIG_SETMASK, &old_mask, NULL);
-        
-        if (WIFEXITED(status)) {
-            g_state.exit_status = WEXITSTATUS(status);
-            return g_state.exit_status;
+        for (int k = 0; k < nstages; k++) {
+            if (pids[k] != pid) continue;
+            statuses[k] = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+            pids[k] = -1;
+            live--;
         }
-        
-        g_state.exit_status = 1;
-        return 1;
     }
+    jobs_take_terminal();
+
+    int status = statuses[nstages - 1];
+    if (pipefail_enabled()) {
+        for (int k = nstages - 1; k >= 0; k--) {
+            if (statuses[k] != 0) {
+                status = statuses[k];
+                break;
+            }
+        }
+    }
+
+    shell->exit_status = status;
+    return status;
 }
 
-int execute_sequence(command *cmds) {
-    if (cmds == NULL) return 0;
+int execute_sequence(command_list *list) {
+    if (list == NULL) return 0;
     
+    command *cmds = list->cmds;
     int last_status = 0;
-    pid_t bg_pids[64];
-    int bg_count = 0;
+    // Words are expanded command by command, right before each one runs
+    arena *mem = arena_acquire();
+    if (!mem) {
+        print_error();
+        return 1;
+    }
+    int group = jobs_new_group();
     
-    for (int i = 0; cmds[i].args != NULL || cmds[i].redir_file != NULL; i++) {
-        if (cmds[i].args == NULL && cmds[i].redir_file == NULL) continue;
-        
+    for (int i = 0; i < list->count; i++) {
         if (i > 0) {
             op_type prev_op = cmds[i-1].next_op;
-            if (prev_op == OP_AND && last_status != 0) continue;
-            if (prev_op == OP_OR && last_status == 0) continue;
+            if ((prev_op == OP_AND && last_status != 0) ||
+                (prev_op == OP_OR && last_status == 0)) {
+                // A skipped pipeline is skipped as a whole
+                while (cmds[i].next_op == OP_PIPE) i++;
+                continue;
+            }
         }
         
-        if (cmds[i].next_op == OP_BG) {
-            sigset_t block_mask, old_mask;
-            sigemptyset(&block_mask);
-            sigaddset(&block_mask, SIGINT);
-            sigprocmask(SIG_BLOCK, &block_mask, &old_mask);
-            
-            pid_t pid = fork();
-            
-            if (pid == 0) {
-                sigprocmask(SIG_SETMASK, &old_mask, NULL);
-                
-                struct sigaction sa;
-                sa.sa_handler = SIG_DFL;
-                sigemptyset(&sa.sa_mask);
-                sa.sa_flags = 0;
-                sigaction(SIGINT, &sa, NULL);
-                
-                if (do_redirection(&cmds[i]) < 0) _exit(1);
-                
-                // Check for alias in background job too
-                char *alias_value = expand_alias(cmds[i].args[0]);
-                if (alias_value) {
-                    // Execute alias
-                    char *line = malloc(strlen(alias_value) + 1024);
-                    if (line) {
-                        strcpy(line, alias_value);
-                        for (int j = 1; cmds[i].args[j]; j++) {
-                            strcat(line, " ");
-                            strcat(line, cmds[i].args[j]);
-                        }
-                        command *alias_cmds = parse_line(line);
-                        free(line);
-                        if (alias_cmds) {
-                            for (int k = 0; alias_cmds[k].args || alias_cmds[k].redir_file; k++) {
-                                if (do_redirection(&alias_cmds[k]) < 0) _exit(1);
-                                int builtin_result = execute_builtin(alias_cmds[k].args);
-                                if (builtin_result != -1) {
-                                    _exit(builtin_result);
-                                }
-                                char *cmd_path = find_in_path(alias_cmds[k].args[0]);
-                                if (!cmd_path) {
-                                    print_error();
-                                    _exit(127);
-                                }
-                                execv(cmd_path, alias_cmds[k].args);
-                                print_error();
-                                _exit(126);
-                            }
-                            free_commands(alias_cmds);
-                        }
-                    }
-                    _exit(1);
-                }
-                
-                int builtin_result = execute_builtin(cmds[i].args);
-                if (builtin_result != -1) {
-                    _exit(builtin_result);
-                }
-                
-                char *cmd_path = find_in_path(cmds[i].args[0]);
-                if (cmd_path == NULL) {
-                    print_error();
-                    _exit(127);
-                }
-                execv(cmd_path, cmds[i].args);
+        int last = i;
+        while (cmds[last].next_op == OP_PIPE) last++;
+        int nstages = last - i + 1;
+        stats.commands += nstages;
+        
+        // A timed '&' job is reported by the scheduler when it ends
+        time_report report;
+        int timed = cmds[i].timed && cmds[last].next_op != OP_BG;
+        if (timed) timing_begin(&report);
+        
+        uint64_t start = phase_start();
+        if (cmds[last].next_op == OP_BG) {
+            // Background work goes through the job scheduler, which starts
+            // it as soon as a slot is free. A job that outlives the line
+            // gets an arena of its own.
+            arena *job_mem = jobs_detached() ? arena_acquire() : mem;
+            char ***argv = job_mem ? expand_stages(job_mem, &cmds[i], nstages) : NULL;
+            phase_end(PHASE_EXPAND, start);
+            if (tracing) trace_current.expand_ns = timing_now();
+            if (!argv) {
+                if (job_mem && job_mem != mem) arena_release(job_mem);
                 print_error();
-                _exit(126);
-            } else if (pid > 0) {
-                sigprocmask(SIG_SETMASK, &old_mask, NULL);
-                bg_pids[bg_count++] = pid;
-                last_status = 0;
-                continue;
             } else {
-                sigprocmask(SIG_SETMASK, &old_mask, NULL);
+                jobs_submit(job_mem == mem ? group : 0, &cmds[i], argv, nstages, job_mem);
+            }
+            last_status = 0;
+        } else if (nstages > 1) {
+            char ***argv = expand_stages(mem, &cmds[i], nstages);
+            phase_end(PHASE_EXPAND, start);
+            if (tracing) trace_current.expand_ns = timing_now();
+            if (!argv) {
                 print_error();
                 last_status = 1;
-                continue;
+            } else {
+                last_status = execute_pipeline(&cmds[i], nstages, argv, mem);
             }
         } else {
-            last_status = execute_single_command(&cmds[i]);
-        }
-        
-        if (cmds[i].next_op == OP_NONE) break;
-    }
-    
-    if (bg_count > 0) {
-        sigset_t block_mask, old_mask;
-        sigemptyset(&block_mask);
-        sigaddset(&block_mask, SIGINT);
-        sigprocmask(SIG_BLOCK, &block_mask, &old_mask);
-        
-        for (int j = 0; j < bg_count; j++) {
-            int status;
-            waitpid(bg_pids[j], &status, 0);
-            
-            sigset_t pending;
-            sigpending(&pending);
-            if (sigismember(&pending, SIGINT)) {
-                siginfo_t info;
-                struct timespec timeout = {0, 0};
-                sigtimedwait(&block_mask, &info, &timeout);
+            char **args = expand_command(mem, &cmds[i]);
+            phase_end(PHASE_EXPAND, start);
+            if (tracing) trace_current.expand_ns = timing_now();
+            if (!args) {
+                print_error();
+                last_status = 1;
+            } else {
+                last_status = execute_single_command(&cmds[i], args);
             }
         }
         
-        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        if (timed) timing_end(&report, list->parse_ns, cmds[i].timed);
+        
+        i = last;
+        if (cmds[i].next_op == OP_NONE || shell->exited) break;
     }
     
-    g_state.exit_status = last_status;
+    jobs_wait_group(group);
+    
+    arena_release(mem);
+    shell->exit_status = last_status;
     return last_status;
 }
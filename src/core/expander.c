@@ -1,168 +1,107 @@
 #include "../include/shell.h"
+#include "../include/arena.h"
+#include "../include/vars.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <ctype.h>
 
-extern shell_state g_state;
+// Expansion builds each word in the context's scratch buffer before copying
+// it into the caller's arena
+static _Thread_local size_t scratch_len = 0;
 
-static char *get_exit_status_str(void) {
-    char *str = malloc(12);
-    if (str) {
-        snprintf(str, 12, "%d", g_state.exit_status);
+static int scratch_append(const char *str, size_t len) {
+    if (scratch_len + len + 1 > shell->scratch_cap) {
+        size_t cap = shell->scratch_cap ? shell->scratch_cap : 256;
+        while (scratch_len + len + 1 > cap) cap *= 2;
+        char *grown = realloc(shell->scratch, cap);
+        if (!grown) return -1;
+        shell->scratch = grown;
+        shell->scratch_cap = cap;
     }
-    return str;
+    memcpy(shell->scratch + scratch_len, str, len);
+    scratch_len += len;
+    return 0;
 }
 
-static char *get_shell_pid_str(void) {
-    char *str = malloc(12);
-    if (str) {
-        snprintf(str, 12, "%d", (int)g_state.shell_pid);
+static int append_path_list(void) {
+    // $PATH is OShell's internal path, not the system PATH
+    for (int i = 0; i < shell->path_count; i++) {
+        if (i > 0 && scratch_append(":", 1) < 0) return -1;
+        const char *dir = shell->path_list[i];
+        if (scratch_append(dir, strlen(dir)) < 0) return -1;
     }
-    return str;
+    return 0;
 }
 
-static char *get_env_var(const char *name) {
-    // SPECIAL HANDLING FOR PATH - return OShell's internal path, not system PATH
-    if (strcmp(name, "PATH") == 0) {
-        // Build OShell's internal path as colon-separated string
-        if (g_state.path_count == 0) {
-            return strdup("");
-        }
-        
-        // Calculate total length needed
-        size_t total_len = 0;
-        for (int i = 0; i < g_state.path_count; i++) {
-            total_len += strlen(g_state.path_list[i]) + 1; // +1 for colon or null terminator
-        }
-        
-        char *path_str = malloc(total_len);
-        if (!path_str) return strdup("");
-        
-        path_str[0] = '\0';
-        for (int i = 0; i < g_state.path_count; i++) {
-            if (i > 0) {
-                strcat(path_str, ":");
-            }
-            strcat(path_str, g_state.path_list[i]);
-        }
-        
-        return path_str;
+static int append_var(const char *name, size_t len) {
+    if (len == 4 && memcmp(name, "PATH", 4) == 0) {
+        return append_path_list();
     }
-    
-    // For all other variables, use system environment
-    char *value = getenv(name);
+
+    const char *value = vars_getn(name, len);
     if (value) {
-        return strdup(value);
+        return scratch_append(value, strlen(value));
+    }
+    return 0;
+}
+
+// $? and $$ as text, rendered again only when the value changes
+typedef struct rendered_int {
+    int value;
+    int len;
+    char text[16];
+} rendered_int;
+
+static _Thread_local rendered_int status_text = {0, 0, ""};
+static _Thread_local rendered_int pid_text = {0, 0, ""};
+
+static int append_int(rendered_int *r, int value) {
+    if (r->len == 0 || r->value != value) {
+        r->len = snprintf(r->text, sizeof(r->text), "%d", value);
+        r->value = value;
     }
-    return strdup("");
+    return scratch_append(r->text, r->len);
 }
 
-char *expand_variables(char *str) {
-    if (!str || strchr(str, '$') == NULL) {
-        return strdup(str ? str : "");
+static char *expand_word(arena *mem, const word *w) {
+    // Plain words need no lookup, only a private copy builtins may modify
+    if (w->nsegs == 1 && w->segs[0].type == SEG_LITERAL) {
+        return arena_strndup(mem, w->segs[0].text, w->segs[0].len);
     }
-    
-    size_t buf_size = strlen(str) * 2 + 1;
-    char *result = malloc(buf_size);
-    if (!result) return NULL;
-    
-    size_t result_pos = 0;
-    
-    for (size_t i = 0; str[i] != '\0'; i++) {
-        if (str[i] == '$' && str[i+1] != '\0') {
-            i++;
-            
-            if (str[i] == '?') {
-                char *exit_str = get_exit_status_str();
-                if (exit_str) {
-                    size_t exit_len = strlen(exit_str);
-                    if (result_pos + exit_len + 1 >= buf_size) {
-                        buf_size = (result_pos + exit_len + 1) * 2;
-                        char *new_result = realloc(result, buf_size);
-                        if (!new_result) {
-                            free(exit_str);
-                            free(result);
-                            return NULL;
-                        }
-                        result = new_result;
-                    }
-                    strcpy(&result[result_pos], exit_str);
-                    result_pos += exit_len;
-                    free(exit_str);
-                }
-                continue;
-            } else if (str[i] == '$') {
-                char *pid_str = get_shell_pid_str();
-                if (pid_str) {
-                    size_t pid_len = strlen(pid_str);
-                    if (result_pos + pid_len + 1 >= buf_size) {
-                        buf_size = (result_pos + pid_len + 1) * 2;
-                        char *new_result = realloc(result, buf_size);
-                        if (!new_result) {
-                            free(pid_str);
-                            free(result);
-                            return NULL;
-                        }
-                        result = new_result;
-                    }
-                    strcpy(&result[result_pos], pid_str);
-                    result_pos += pid_len;
-                    free(pid_str);
-                }
-                continue;
-            }
-            
-            size_t start = i;
-            while (str[i] != '\0' && 
-                   (isalnum((unsigned char)str[i]) || str[i] == '_')) {
-                i++;
-            }
-            size_t var_len = i - start;
-            i--;
-            
-            if (var_len > 0) {
-                char var_name[256];
-                if (var_len < sizeof(var_name)) {
-                    strncpy(var_name, &str[start], var_len);
-                    var_name[var_len] = '\0';
-                    
-                    char *value = get_env_var(var_name);
-                    if (value) {
-                        size_t value_len = strlen(value);
-                        if (result_pos + value_len + 1 >= buf_size) {
-                            buf_size = (result_pos + value_len + 1) * 2;
-                            char *new_result = realloc(result, buf_size);
-                            if (!new_result) {
-                                free(value);
-                                free(result);
-                                return NULL;
-                            }
-                            result = new_result;
-                        }
-                        strcpy(&result[result_pos], value);
-                        result_pos += value_len;
-                        free(value);
-                    }
-                }
-            }
-        } else {
-            if (result_pos + 2 >= buf_size) {
-                buf_size *= 2;
-                char *new_result = realloc(result, buf_size);
-                if (!new_result) {
-                    free(result);
-                    return NULL;
-                }
-                result = new_result;
-            }
-            result[result_pos++] = str[i];
+
+    scratch_len = 0;
+    for (int i = 0; i < w->nsegs; i++) {
+        const word_seg *seg = &w->segs[i];
+        int rc = 0;
+        switch (seg->type) {
+            case SEG_LITERAL:
+                rc = scratch_append(seg->text, seg->len);
+                break;
+            case SEG_VAR:
+                rc = append_var(seg->text, seg->len);
+                break;
+            case SEG_STATUS:
+                rc = append_int(&status_text, shell->exit_status);
+                break;
+            case SEG_PID:
+                rc = append_int(&pid_text, (int)shell->shell_pid);
+                break;
         }
+        if (rc < 0) return NULL;
+    }
+    return arena_strndup(mem, shell->scratch ? shell->scratch : "", scratch_len);
+}
+
+// Expand a parsed command into a NULL-terminated argv allocated from `mem`.
+// Runs at execution time so $? and the environment are current.
+char **expand_command(arena *mem, const command *cmd) {
+    char **args = arena_alloc(mem, (cmd->argc + 1) * sizeof(char *));
+    if (!args) return NULL;
+
+    for (int i = 0; i < cmd->argc; i++) {
+        args[i] = expand_word(mem, &cmd->words[i]);
+        if (!args[i]) return NULL;
     }
-    
-    result[result_pos] = '\0';
-    
-    char *final = strdup(result);
-    free(result);
-    return final;
+    args[cmd->argc] = NULL;
+    return args;
 }
@@ -0,0 +1,792 @@
+#define _GNU_SOURCE
+#include "../include/jobs.h"
+#include "../include/arena.h"
+#include "../include/errors.h"
+#include "../include/events.h"
+#include "../include/vars.h"
+#include "../include/timing.h"
+#include "../include/stats.h"
+#include "../include/zygote.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define JOBS_INITIAL 16
+
+// Children reaped while waiting for someone else, until wait_child() asks
+typedef struct reaped_child {
+    pid_t pid;
+    int status;
+} reaped_child;
+
+struct job_table {
+    // Background work of every line still executing, and under job control
+    // every job not yet reported, in submission order
+    job *jobs;
+    int count;
+    int cap;
+    int running;
+    int limit;
+    int next_group;
+    int next_id;
+    int detach; // jobs outlive their line
+
+    reaped_child *unclaimed;
+    int unclaimed_count;
+    int unclaimed_cap;
+    int lost;  // reaped children whose status could not be kept
+    int depth; // lines executing, counting alias bodies
+};
+
+// Called while a child runs; returns nonzero as long as it found work to do.
+// Per thread, as only the thread that set it fills its readahead queue.
+static _Thread_local int (*wait_hook)(void) = NULL;
+
+// Job control of the process's own context: the terminal (-1: none), and
+// the shell's process group and terminal settings
+static int terminal_fd = -1;
+static pid_t shell_pgid;
+static struct termios shell_tmodes;
+
+void set_wait_hook(int (*hook)(void)) {
+    wait_hook = hook;
+}
+
+job_table *job_table_new(void) {
+    job_table *t = calloc(1, sizeof(job_table));
+    if (t) t->next_id = 1;
+    return t;
+}
+
+// Jobs that outlive their line may still be running; they are left to run
+void job_table_free(job_table *t) {
+    if (!t) return;
+    for (int i = 0; i < t->count; i++) {
+        if (t->jobs[i].mem) arena_release(t->jobs[i].mem);
+    }
+    free(t->jobs);
+    free(t->unclaimed);
+    free(t);
+}
+
+int jobs_get_limit(void) {
+    job_table *t = shell->jobs;
+    if (t->limit <= 0) {
+        const char *env = vars_get("OSHELL_JOBS");
+        int n = env ? atoi(env) : 0;
+        if (n <= 0) n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        t->limit = n > 0 ? n : 1;
+    }
+    return t->limit;
+}
+
+void jobs_set_limit(int limit) {
+    shell->jobs->limit = limit;
+}
+
+// Called as a line starts executing; jobs_wait_group() ends it
+int jobs_new_group(void) {
+    shell->jobs->depth++;
+    return ++shell->jobs->next_group;
+}
+
+static void jobs_schedule(void);
+
+// Every change of state goes through here, so `running` counts the jobs in
+// JOB_RUNNING. A job that stops gives up its slot; one that is continued
+// takes one back even if that goes over the limit.
+static void set_state(job *j, job_state state) {
+    job_table *t = shell->jobs;
+    if (j->state == state) return;
+    job_state old = j->state;
+    j->state = state;
+    j->notified = 0;
+    if (state == JOB_RUNNING) {
+        t->running++;
+        if ((unsigned long)t->running > stats.peak_jobs) stats.peak_jobs = t->running;
+    }
+    if (old == JOB_RUNNING) {
+        t->running--;
+        jobs_schedule();
+    }
+}
+
+static void start_job(job *j, int foreground) {
+    // Trace records of the job's children belong to its own line
+    trace_context current = trace_current;
+    trace_current = j->trace;
+    j->start_ns = timing_now();
+    j->live = start_pipeline(j->cmds, j->argv, j->nstages, j->pids, j->statuses, foreground);
+    trace_current = current;
+
+    for (int k = 0; k < j->nstages && terminal_fd >= 0; k++) {
+        if (j->pids[k] > 0) {
+            j->pgid = j->pids[k];
+            break;
+        }
+    }
+    set_state(j, j->live > 0 ? JOB_RUNNING : JOB_DONE);
+}
+
+// Start queued jobs, oldest first, while there are free slots. Jobs that
+// outlive their line are interactive work, which starts at once however
+// many are running.
+static void jobs_schedule(void) {
+    job_table *t = shell->jobs;
+    int limit = jobs_get_limit();
+    for (int i = 0; i < t->count; i++) {
+        job *j = &t->jobs[i];
+        if (j->state == JOB_QUEUED && (j->group == 0 || t->running < limit)) {
+            start_job(j, 0);
+        }
+    }
+}
+
+// A new table entry for a job of `nstages` stages, allocated from `mem`.
+// A job that outlives its line owns `mem` and takes the lowest number above
+// those in use.
+static job *new_job(int group, int nstages, arena *mem) {
+    job_table *t = shell->jobs;
+    if (t->count == t->cap) {
+        int cap = t->cap ? t->cap * 2 : JOBS_INITIAL;
+        job *grown = realloc(t->jobs, cap * sizeof(job));
+        if (!grown) return NULL;
+        t->jobs = grown;
+        t->cap = cap;
+    }
+
+    job *j = &t->jobs[t->count];
+    memset(j, 0, sizeof(*j));
+    j->pids = arena_calloc(mem, nstages, sizeof(pid_t));
+    j->statuses = arena_calloc(mem, nstages, sizeof(int));
+    if (!j->pids || !j->statuses) return NULL;
+    if (group == 0) {
+        j->id = 1;
+        for (int i = 0; i < t->count; i++) {
+            if (t->jobs[i].id >= j->id) j->id = t->jobs[i].id + 1;
+        }
+        j->mem = mem;
+    } else {
+        j->id = t->next_id++;
+    }
+    j->group = group;
+    j->nstages = nstages;
+    j->trace = trace_current;
+    t->count++;
+    return j;
+}
+
+static void remove_job(job *j) {
+    job_table *t = shell->jobs;
+    if (j->state == JOB_RUNNING) t->running--;
+    if (j->mem) arena_release(j->mem);
+    int i = j - t->jobs;
+    memmove(&t->jobs[i], &t->jobs[i + 1], (t->count - i - 1) * sizeof(job));
+    t->count--;
+}
+
+// Group 0 makes a job that outlives its line: it takes `mem`, which holds
+// its words, and keeps its own copy of the commands' redirections.
+int jobs_submit(int group, command *cmds, char ***argv, int nstages, arena *mem) {
+    job *j = new_job(group, nstages, mem);
+    command *copy = j && group == 0 ? arena_calloc(mem, nstages, sizeof(command)) : NULL;
+    for (int k = 0; copy && k < nstages; k++) {
+        copy[k] = cmds[k];
+        copy[k].words = NULL;
+        copy[k].argc = 0;
+        if (cmds[k].redir_file) {
+            copy[k].redir_file = arena_strdup(mem, cmds[k].redir_file);
+            if (!copy[k].redir_file) copy = NULL;
+        }
+    }
+    if (!j || (group == 0 && !copy)) {
+        if (j) shell->jobs->count--;
+        if (group == 0) arena_release(mem);
+        print_error();
+        return 1;
+    }
+
+    j->state = JOB_QUEUED;
+    j->cmds = group == 0 ? copy : cmds;
+    j->argv = argv;
+    j->timed = cmds[0].timed;
+    jobs_schedule();
+
+    // As other shells do, so the job can be told apart later. A job that
+    // could not be started has had its error reported already.
+    for (int k = 0; k < nstages && group == 0; k++) {
+        if (j->pids[k] <= 0) continue;
+        fprintf(shell->err, "[%d] %d\n", j->id, (int)j->pids[k]);
+        break;
+    }
+    return 0;
+}
+
+// Record a reaped child's exit, stop or continuation against its job.
+// Returns 0 if no job owns it.
+static int jobs_child_changed(pid_t pid, int status, const struct rusage *ru) {
+    job_table *t = shell->jobs;
+    for (int i = 0; i < t->count; i++) {
+        job *j = &t->jobs[i];
+        if (j->state != JOB_RUNNING && j->state != JOB_STOPPED) continue;
+        for (int k = 0; k < j->nstages; k++) {
+            if (j->pids[k] != pid) continue;
+            if (WIFSTOPPED(status)) {
+                j->signo = WSTOPSIG(status);
+                set_state(j, JOB_STOPPED);
+                return 1;
+            }
+            if (WIFCONTINUED(status)) {
+                set_state(j, JOB_RUNNING);
+                return 1;
+            }
+            j->statuses[k] = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+            if (k == j->nstages - 1) j->signo = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+            j->pids[k] = -1;
+            rusage_add(&j->usage, ru);
+            if (--j->live == 0) {
+                if (j->timed) {
+                    timing_print(j->timed, timing_now() - j->start_ns, &j->usage, NULL);
+                }
+                set_state(j, JOB_DONE);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Out of memory, the status is lost, but its waiter must not block: it
+// finds the child gone instead (see wait_any_child())
+static void keep_unclaimed(pid_t pid, int status) {
+    job_table *t = shell->jobs;
+    if (t->unclaimed_count == t->unclaimed_cap) {
+        int cap = t->unclaimed_cap ? t->unclaimed_cap * 2 : JOBS_INITIAL;
+        reaped_child *grown = realloc(t->unclaimed, cap * sizeof(reaped_child));
+        if (!grown) {
+            print_error();
+            t->lost++;
+            return;
+        }
+        t->unclaimed = grown;
+        t->unclaimed_cap = cap;
+    }
+    t->unclaimed[t->unclaimed_count++] = (reaped_child){pid, status};
+}
+
+static void child_reaped(pid_t pid, int status, const struct rusage *ru) {
+    int ended = !WIFSTOPPED(status) && !WIFCONTINUED(status);
+    if (tracing && ended) trace_reaped(pid, status);
+    if (!jobs_child_changed(pid, status, ru) && !WIFCONTINUED(status)) {
+        // Foreground work counts toward any `time` in progress; a stopped
+        // foreground child is for its waiter to deal with
+        if (ended) timing_child_reaped(ru);
+        keep_unclaimed(pid, status);
+    }
+}
+
+// Reap every child that has exited, in the order they finished. Under job
+// control children that stop or continue are reported too.
+void jobs_reap(void) {
+    int flags = WNOHANG | (terminal_fd >= 0 ? WUNTRACED | WCONTINUED : 0);
+    int status;
+    struct rusage ru;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, flags, &ru)) > 0) {
+        child_reaped(pid, status, &ru);
+    }
+}
+
+// A library context shares the process with its host and with other
+// contexts, so it takes no SIGCHLD and never waits for any child but its
+// own: it polls pidfds of the children it waits for and of its running
+// jobs. Returns 0 on error.
+static int reap_own(const pid_t *pids, int count) {
+    job_table *t = shell->jobs;
+    int max = count;
+    for (int i = 0; i < t->count; i++) {
+        if (t->jobs[i].state == JOB_RUNNING) max += t->jobs[i].nstages;
+    }
+    pid_t *owned = malloc(max * sizeof(pid_t));
+    struct pollfd *pfds = malloc(max * sizeof(struct pollfd));
+    int n = 0;
+    if (owned && pfds) {
+        for (int i = 0; i < count; i++) {
+            if (pids[i] > 0) owned[n++] = pids[i];
+        }
+        for (int i = 0; i < t->count; i++) {
+            job *j = &t->jobs[i];
+            if (j->state != JOB_RUNNING) continue;
+            for (int k = 0; k < j->nstages; k++) {
+                if (j->pids[k] > 0) owned[n++] = j->pids[k];
+            }
+        }
+    }
+
+    int opened = 0;
+    for (int i = 0; i < n; i++) {
+        pfds[i].fd = (int)syscall(SYS_pidfd_open, owned[i], 0);
+        pfds[i].events = POLLIN;
+        if (pfds[i].fd >= 0) opened++;
+    }
+
+    int status;
+    struct rusage ru;
+    int found = 0;
+    if (opened > 0) {
+        if (poll(pfds, n, -1) < 0) {
+            // Interrupted: let the caller look again
+            found = (errno == EINTR);
+        } else {
+            for (int i = 0; i < n; i++) {
+                if (pfds[i].fd < 0 || !(pfds[i].revents & POLLIN)) continue;
+                if (wait4(owned[i], &status, WNOHANG, &ru) > 0) {
+                    child_reaped(owned[i], status, &ru);
+                    found = 1;
+                }
+            }
+        }
+    } else if (n > 0) {
+        // No pidfds; block on the first child instead
+        if (wait4(owned[0], &status, 0, &ru) == owned[0]) {
+            child_reaped(owned[0], status, &ru);
+            found = 1;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (pfds[i].fd >= 0) close(pfds[i].fd);
+    }
+    free(owned);
+    free(pfds);
+    return found;
+}
+
+// Wait for children to exit, lending idle time to the wait hook one unit of
+// work at a time before blocking. Interrupts that arrive meanwhile belong to
+// the foreground children and are dropped, unless `interruptible` is set:
+// then they end the wait. Returns 0 on error or interrupt.
+static int reap_next(const pid_t *pids, int count, int interruptible) {
+    if (shell != &shell_process) return reap_own(pids, count);
+
+    int hook_idle = (wait_hook == NULL);
+    while (1) {
+        int events = events_wait(-1, hook_idle ? -1 : 0);
+        if (events < 0) return 0;
+        if (events & EVENT_CHILD) jobs_reap();
+        if (interruptible && (events & EVENT_INTERRUPT)) return 0;
+        if (events & EVENT_CHILD) return 1;
+        if (events == 0 && !hook_idle) {
+            if (wait_hook()) return 1;
+            hook_idle = 1;
+        }
+    }
+}
+
+// Wait for whichever of pids[0..count-1] exits (or, under job control,
+// stops) first and return it. Every other child that exits meanwhile is
+// reaped too, so finished jobs free their slots right away.
+pid_t wait_any_child(const pid_t *pids, int count, int *status) {
+    job_table *t = shell->jobs;
+    while (1) {
+        for (int i = 0; i < t->unclaimed_count; i++) {
+            for (int k = 0; k < count; k++) {
+                if (t->unclaimed[i].pid != pids[k]) continue;
+                pid_t pid = t->unclaimed[i].pid;
+                *status = t->unclaimed[i].status;
+                t->unclaimed[i] = t->unclaimed[--t->unclaimed_count];
+                return pid;
+            }
+        }
+        // One already reaped, whose status was lost: it failed
+        for (int k = 0; k < count && t->lost > 0; k++) {
+            siginfo_t info;
+            if (pids[k] > 0 &&
+                waitid(P_PID, pids[k], &info, WEXITED | WNOHANG | WNOWAIT) < 0 &&
+                errno == ECHILD) {
+                t->lost--;
+                *status = W_EXITCODE(1, 0);
+                return pids[k];
+            }
+        }
+        if (!reap_next(pids, count, 0)) return -1;
+    }
+}
+
+// waitpid() for one foreground child
+pid_t wait_child(pid_t pid, int *status) {
+    return wait_any_child(&pid, 1, status);
+}
+
+static int group_pending(int group) {
+    job_table *t = shell->jobs;
+    for (int i = 0; i < t->count; i++) {
+        if (t->jobs[i].group == group && t->jobs[i].state != JOB_DONE) return 1;
+    }
+    return 0;
+}
+
+// Wait until every job of a group has run, then drop them from the table
+void jobs_wait_group(int group) {
+    job_table *t = shell->jobs;
+    while (group_pending(group)) {
+        if (!reap_next(NULL, 0, 0)) break;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < t->count; i++) {
+        if (t->jobs[i].group != group) t->jobs[kept++] = t->jobs[i];
+    }
+    t->count = kept;
+
+    // Children nobody claimed by the end of a line, such as a zygote helper
+    // that exited, are no one's to wait for any more
+    if (--t->depth == 0) {
+        t->unclaimed_count = 0;
+        t->lost = 0;
+    }
+}
+
+static void print_command(FILE *out, const job *j) {
+    for (int k = 0; k < j->nstages; k++) {
+        if (k > 0) fprintf(out, " |");
+        for (char **arg = j->argv[k]; *arg; arg++) {
+            fprintf(out, "%s%s", k == 0 && arg == j->argv[0] ? "" : " ", *arg);
+        }
+    }
+}
+
+static void print_job(FILE *out, const job *j) {
+    char state[32];
+    int status = j->statuses[j->nstages - 1];
+    if (j->state == JOB_QUEUED) snprintf(state, sizeof(state), "Queued");
+    else if (j->state == JOB_RUNNING) snprintf(state, sizeof(state), "Running");
+    else if (j->state == JOB_STOPPED) snprintf(state, sizeof(state), "Stopped");
+    else if (j->signo) snprintf(state, sizeof(state), "%s", strsignal(j->signo));
+    else if (status) snprintf(state, sizeof(state), "Exit %d", status);
+    else snprintf(state, sizeof(state), "Done");
+
+    fprintf(out, "[%d] %-8s ", j->id, state);
+    print_command(out, j);
+    fprintf(out, "\n");
+}
+
+// Jobs of lines still running are listed until they finish; jobs that
+// outlive their line until their end has been listed or reported
+void jobs_print(void) {
+    job_table *t = shell->jobs;
+    for (int i = 0; i < t->count; i++) {
+        job *j = &t->jobs[i];
+        if (j->state == JOB_DONE && j->group != 0) continue;
+        print_job(shell->out, j);
+        j->notified = 1;
+        if (j->state == JOB_DONE) remove_job(&t->jobs[i--]);
+    }
+}
+
+// A forked copy of the shell runs its own commands; the parent's jobs and
+// children are not its to wait for, and the terminal is not its to manage
+void jobs_child_reset(void) {
+    shell->jobs->count = 0;
+    shell->jobs->running = 0;
+    shell->jobs->unclaimed_count = 0;
+    shell->jobs->lost = 0;
+    shell->jobs->depth = 0;
+    shell->jobs->detach = 0;
+    terminal_fd = -1;
+    set_wait_hook(NULL);
+    events_child_reset();
+    trace_child_reset();
+    zygote_child_reset();
+}
+
+// ============= JOB CONTROL =============
+
+// Interactive mode: jobs outlive the line that starts them. On a terminal
+// the shell also becomes a process group of its own in the foreground, and
+// every job gets its own group, which has the terminal while it runs in the
+// foreground.
+void jobs_control_init(void) {
+    shell->jobs->detach = 1;
+    if (!isatty(STDIN_FILENO)) return;
+
+    // Started in the background by another shell: wait to be brought to
+    // the foreground first
+    pid_t pgid;
+    pid_t fg;
+    while ((fg = tcgetpgrp(STDIN_FILENO)) >= 0 && fg != (pgid = getpgrp())) {
+        kill(-pgid, SIGTTIN);
+    }
+    if (fg < 0) return;
+
+    // Stop signals from the terminal are for the jobs. The shell keeps them
+    // blocked; what it starts gets the mask it started with.
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGTSTP);
+    sigaddset(&block, SIGTTIN);
+    sigaddset(&block, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &block, NULL);
+
+    // Fails harmlessly if the shell already leads its session
+    setpgid(0, 0);
+    shell_pgid = getpgrp();
+    if (tcsetpgrp(STDIN_FILENO, shell_pgid) < 0) return;
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+    terminal_fd = STDIN_FILENO;
+}
+
+int jobs_detached(void) {
+    return shell->jobs->detach;
+}
+
+int jobs_terminal(void) {
+    return terminal_fd;
+}
+
+// Give the terminal back to the shell once a foreground job has finished
+// or stopped, with the shell's own settings
+void jobs_take_terminal(void) {
+    if (terminal_fd < 0) return;
+    tcsetpgrp(terminal_fd, shell_pgid);
+    tcsetattr(terminal_fd, TCSADRAIN, &shell_tmodes);
+}
+
+// A foreground pipeline stopped (Ctrl-Z): keep what is left of it as a
+// stopped job, with its own copy of the words, and report it. pids[] holds
+// the stages still running; statuses[] those of the rest. Stages that have
+// changed meanwhile are picked up from the unclaimed children. Returns the
+// exit status of the stopped pipeline.
+int jobs_stopped(char ***argv, int nstages, pid_t *pids, int *statuses, int wstatus) {
+    job_table *t = shell->jobs;
+    int status = 128 + WSTOPSIG(wstatus);
+    arena *mem = arena_acquire();
+    job *j = mem ? new_job(0, nstages, mem) : NULL;
+    char ***copy = j ? arena_calloc(mem, nstages, sizeof(char **)) : NULL;
+    for (int k = 0; copy && k < nstages; k++) {
+        int argc = 0;
+        while (argv[k][argc]) argc++;
+        copy[k] = arena_calloc(mem, argc + 1, sizeof(char *));
+        if (!copy[k]) {
+            copy = NULL;
+            break;
+        }
+        for (int i = 0; i < argc && copy; i++) {
+            copy[k][i] = arena_strdup(mem, argv[k][i]);
+            if (!copy[k][i]) copy = NULL;
+        }
+    }
+    if (!copy) {
+        // The stages cannot be kept track of; let them go on
+        if (j) t->count--;
+        if (mem) arena_release(mem);
+        for (int k = 0; k < nstages; k++) {
+            if (pids[k] > 0) kill(pids[k], SIGCONT);
+        }
+        print_error();
+        return status;
+    }
+
+    j->argv = copy;
+    j->state = JOB_STOPPED;
+    j->signo = WSTOPSIG(wstatus);
+    for (int k = 0; k < nstages; k++) {
+        j->pids[k] = pids[k];
+        j->statuses[k] = statuses[k];
+        if (pids[k] <= 0) continue;
+        if (j->pgid == 0) j->pgid = getpgid(pids[k]);
+        j->live++;
+        for (int i = 0; i < t->unclaimed_count; i++) {
+            if (t->unclaimed[i].pid != pids[k]) continue;
+            int other = t->unclaimed[i].status;
+            t->unclaimed[i--] = t->unclaimed[--t->unclaimed_count];
+            if (!WIFSTOPPED(other)) {
+                j->statuses[k] = WIFEXITED(other) ? WEXITSTATUS(other) : 1;
+                j->pids[k] = -1;
+                j->live--;
+            }
+        }
+    }
+    if (terminal_fd >= 0) tcgetattr(terminal_fd, &j->tmodes);
+
+    // On a line of its own, after the echoed ^Z
+    fprintf(shell->err, "\n");
+    print_job(shell->err, j);
+    j->notified = 1;
+    return status;
+}
+
+// Before a prompt: report jobs that have finished or stopped since the last
+// one, and forget the finished ones
+void jobs_notify(void) {
+    job_table *t = shell->jobs;
+    for (int i = 0; i < t->count; i++) {
+        job *j = &t->jobs[i];
+        if (j->group != 0 || j->notified) continue;
+        if (j->state != JOB_DONE && j->state != JOB_STOPPED) continue;
+        print_job(shell->err, j);
+        j->notified = 1;
+        if (j->state == JOB_DONE) remove_job(&t->jobs[i--]);
+    }
+}
+
+job *jobs_find(const char *spec, int bare_ids) {
+    if (strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        return jobs_current(0);
+    }
+    if (*spec == '%') spec++;
+    else if (!bare_ids) return NULL;
+
+    char *end;
+    long id = strtol(spec, &end, 10);
+    if (end == spec || *end != '\0') return NULL;
+    job_table *t = shell->jobs;
+    for (int i = 0; i < t->count; i++) {
+        if (t->jobs[i].id == id) return &t->jobs[i];
+    }
+    return NULL;
+}
+
+job *jobs_find_pid(pid_t pid) {
+    job_table *t = shell->jobs;
+    for (int i = 0; i < t->count; i++) {
+        job *j = &t->jobs[i];
+        if (j->pgid == pid) return j;
+        for (int k = 0; k < j->nstages; k++) {
+            if (j->pids[k] == pid) return j;
+        }
+    }
+    return NULL;
+}
+
+// The job fg and bg act on by default: the newest stopped job, or else the
+// newest one still to finish
+job *jobs_current(int stopped_only) {
+    job_table *t = shell->jobs;
+    job *current = NULL;
+    for (int i = 0; i < t->count; i++) {
+        if (t->jobs[i].state == JOB_STOPPED) current = &t->jobs[i];
+    }
+    for (int i = 0; i < t->count && !current && !stopped_only; i++) {
+        if (t->jobs[i].state != JOB_DONE) current = &t->jobs[i];
+    }
+    return current;
+}
+
+static int job_status(const job *j) {
+    if (j->state == JOB_STOPPED) return 128 + j->signo;
+    return j->statuses[j->nstages - 1];
+}
+
+// A job that has been waited for has been reported
+static int job_waited(job *j) {
+    int status = job_status(j);
+    if (j->state == JOB_DONE && j->group == 0) remove_job(j);
+    return status;
+}
+
+// Wait until the job finishes or stops, and return its status. Ctrl-C ends
+// the wait with 130.
+int jobs_wait(job *j) {
+    while (j->state == JOB_QUEUED || j->state == JOB_RUNNING) {
+        if (!reap_next(NULL, 0, 1)) return 130;
+    }
+    return job_waited(j);
+}
+
+// Wait until no job is left to run
+int jobs_wait_all(void) {
+    job_table *t = shell->jobs;
+    while (1) {
+        int pending = 0;
+        for (int i = 0; i < t->count; i++) {
+            job_state state = t->jobs[i].state;
+            if (state == JOB_QUEUED || state == JOB_RUNNING) pending = 1;
+        }
+        if (!pending) break;
+        if (!reap_next(NULL, 0, 1)) return 130;
+    }
+    for (int i = 0; i < t->count; i++) {
+        if (t->jobs[i].state == JOB_DONE && t->jobs[i].group == 0) remove_job(&t->jobs[i--]);
+    }
+    return 0;
+}
+
+// Send `sig` to every process of the job. A stopped job is also continued,
+// so that it can act on the signal; a queued one ends before it starts.
+int jobs_signal(job *j, int sig) {
+    if (j->state == JOB_QUEUED) {
+        if (sig == 0 || sig == SIGCONT) return 0;
+        j->signo = sig;
+        j->statuses[j->nstages - 1] = 1;
+        set_state(j, JOB_DONE);
+        return 0;
+    }
+
+    int rc = 0;
+    if (j->pgid > 0) {
+        rc = kill(-j->pgid, sig);
+    } else {
+        for (int k = 0; k < j->nstages; k++) {
+            if (j->pids[k] > 0 && kill(j->pids[k], sig) < 0) rc = -1;
+        }
+    }
+    if (j->state == JOB_STOPPED && sig != SIGCONT && sig != SIGSTOP && sig != SIGTSTP &&
+        sig != SIGTTIN && sig != SIGTTOU && sig != 0) {
+        jobs_signal(j, SIGCONT);
+    }
+    return rc;
+}
+
+// Bring a job to the foreground, continuing it if it is stopped, and wait
+// for it as for a command typed at the prompt
+int jobs_foreground(job *j) {
+    print_command(shell->out, j);
+    fprintf(shell->out, "\n");
+    fflush(shell->out);
+
+    if (j->state == JOB_QUEUED) {
+        start_job(j, 1);
+    } else if (terminal_fd >= 0 && j->pgid > 0) {
+        if (j->state == JOB_STOPPED) tcsetattr(terminal_fd, TCSADRAIN, &j->tmodes);
+        tcsetpgrp(terminal_fd, j->pgid);
+    }
+    if (j->state == JOB_STOPPED) {
+        jobs_signal(j, SIGCONT);
+        set_state(j, JOB_RUNNING);
+    }
+
+    while (j->state == JOB_RUNNING) {
+        if (!reap_next(NULL, 0, 0)) break;
+    }
+    if (terminal_fd >= 0) {
+        if (j->state == JOB_STOPPED) tcgetattr(terminal_fd, &j->tmodes);
+        jobs_take_terminal();
+    }
+    if (j->state == JOB_STOPPED) {
+        fprintf(shell->err, "\n");
+        print_job(shell->err, j);
+        j->notified = 1;
+    }
+    return job_waited(j);
+}
+
+// Continue a stopped job in the background
+int jobs_background(job *j) {
+    if (j->state != JOB_STOPPED) return 0;
+    if (jobs_signal(j, SIGCONT) < 0) return 1;
+    set_state(j, JOB_RUNNING);
+    j->notified = 1;
+    fprintf(shell->out, "[%d] ", j->id);
+    print_command(shell->out, j);
+    fprintf(shell->out, " &\n");
+    return 0;
+}
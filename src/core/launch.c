@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include "../include/launch.h"
+#include "../include/events.h"
+#include "../include/jobs.h"
+#include "../include/vars.h"
+#include "../include/timing.h"
+#include "../include/trace.h"
+#include "../include/stats.h"
+#include "../include/zygote.h"
+#include "../include/errors.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+
+#define COMMAND_HASH_INITIAL 64
+
+static _Thread_local int backend = -1;
+
+// Command name -> resolved path, filled by find_in_path() and cleared
+// whenever the path list changes, or the working directory does while the
+// list has relative entries. Open addressing with linear probing.
+typedef struct hash_entry {
+    char *name;
+    char *path;
+    unsigned long hits;
+} hash_entry;
+
+struct command_hash {
+    hash_entry *table;
+    size_t cap;
+    size_t count;
+};
+
+// Chosen once, by the process's own context; other contexts spawn. Kept per
+// thread so a context on another thread never sees it change under it.
+launch_backend launch_get_backend(void) {
+    if (backend < 0) {
+        if (shell != &shell_process) return LAUNCH_SPAWN;
+        const char *name = vars_get("OSHELL_LAUNCH");
+        if (name && strcmp(name, "fork") == 0) backend = LAUNCH_FORK;
+        else if (name && strcmp(name, "zygote") == 0) backend = LAUNCH_ZYGOTE;
+        else backend = LAUNCH_SPAWN;
+    }
+    return backend;
+}
+
+void launch_set_backend(launch_backend b) {
+    backend = b;
+}
+
+static size_t hash_name(const char *name) {
+    size_t h = 5381;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h = h * 33 + *p;
+    }
+    return h;
+}
+
+static hash_entry *hash_slot(hash_entry *table, size_t cap, const char *name) {
+    size_t i = hash_name(name) & (cap - 1);
+    while (table[i].name && strcmp(table[i].name, name) != 0) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &table[i];
+}
+
+static int hash_grow(command_hash *h) {
+    size_t cap = h->cap ? h->cap * 2 : COMMAND_HASH_INITIAL;
+    hash_entry *table = calloc(cap, sizeof(hash_entry));
+    if (!table) return -1;
+    for (size_t i = 0; i < h->cap; i++) {
+        if (h->table[i].name) {
+            *hash_slot(table, cap, h->table[i].name) = h->table[i];
+        }
+    }
+    free(h->table);
+    h->table = table;
+    h->cap = cap;
+    return 0;
+}
+
+static void hash_clear(command_hash *h) {
+    for (size_t i = 0; i < h->cap; i++) {
+        free(h->table[i].name);
+        free(h->table[i].path);
+    }
+    free(h->table);
+    h->table = NULL;
+    h->cap = 0;
+    h->count = 0;
+}
+
+command_hash *command_hash_new(void) {
+    return calloc(1, sizeof(command_hash));
+}
+
+void command_hash_free(command_hash *h) {
+    if (!h) return;
+    hash_clear(h);
+    free(h);
+}
+
+void command_hash_clear(void) {
+    hash_clear(shell->hash);
+}
+
+// After cd: names found through a relative path entry were resolved
+// against the old directory
+void command_hash_chdir(void) {
+    for (int i = 0; i < shell->path_count; i++) {
+        if (shell->path_list[i][0] != '/') {
+            hash_clear(shell->hash);
+            return;
+        }
+    }
+}
+
+void command_hash_print(void) {
+    command_hash *h = shell->hash;
+    if (h->count == 0) return;
+    fprintf(shell->out, "hits\tcommand\n");
+    for (size_t i = 0; i < h->cap; i++) {
+        if (h->table[i].name) {
+            fprintf(shell->out, "%4lu\t%s\n", h->table[i].hits, h->table[i].path);
+        }
+    }
+}
+
+static char *search_path(const char *cmd) {
+    size_t cmd_len = strlen(cmd);
+    for (int i = 0; i < shell->path_count; i++) {
+        char *path = shell->path_list[i];
+        size_t len = strlen(path) + cmd_len + 2;
+        char *full = malloc(len);
+        if (!full) return NULL;
+        snprintf(full, len, "%s/%s", path, cmd);
+        if (faccessat(shell->cwd_fd, full, X_OK, 0) == 0) return full;
+        free(full);
+    }
+    return NULL;
+}
+
+// Resolve a command to the path to exec. Names without a slash go through
+// the command hash, so the PATH walk and its access() calls happen once per
+// name; a hit only checks that the file is still there, and a command that
+// has gone is looked up again. The result is owned by the hash (or is `cmd`
+// itself) and stays valid until the hash is cleared.
+const char *find_in_path(const char *cmd) {
+    if (strchr(cmd, '/') != NULL) {
+        if (faccessat(shell->cwd_fd, cmd, X_OK, 0) == 0) return cmd;
+        return NULL;
+    }
+
+    command_hash *h = shell->hash;
+    stats.path_lookups++;
+    if (h->count > 0) {
+        hash_entry *e = hash_slot(h->table, h->cap, cmd);
+        if (e->name) {
+            if (faccessat(shell->cwd_fd, e->path, X_OK, 0) == 0) {
+                e->hits++;
+                stats.path_hits++;
+                return e->path;
+            }
+            char *path = search_path(cmd);
+            if (!path) return NULL;
+            free(e->path);
+            e->path = path;
+            e->hits++;
+            return path;
+        }
+    }
+
+    char *path = search_path(cmd);
+    if (!path) return NULL;
+
+    // Keep the table at most half full
+    if ((h->count + 1) * 2 > h->cap && hash_grow(h) < 0) {
+        free(path);
+        return NULL;
+    }
+    hash_entry *e = hash_slot(h->table, h->cap, cmd);
+    e->name = strdup(cmd);
+    if (!e->name) {
+        free(path);
+        return NULL;
+    }
+    e->path = path;
+    e->hits = 1;
+    h->count++;
+    return path;
+}
+
+static pid_t launch_fork(const char *path, char **args, char **envp, int in_fd,
+                         int out_fd, int err_fd, const sigset_t *child_mask,
+                         const process_group *group) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        if (pid > 0) stats.forks++;
+        return pid;
+    }
+
+    // While SIGTTOU is still blocked, as tcsetpgrp() from the background
+    // needs it to be
+    if (group) {
+        setpgid(0, group->pgid);
+        if (group->foreground) tcsetpgrp(jobs_terminal(), getpgrp());
+    }
+    sigprocmask(SIG_SETMASK, child_mask, NULL);
+
+    struct sigaction sa;
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+
+    if (in_fd >= 0 && dup2(in_fd, STDIN_FILENO) < 0) _exit(1);
+    if (out_fd >= 0 && dup2(out_fd, STDOUT_FILENO) < 0) _exit(1);
+    if (err_fd >= 0 && dup2(err_fd, STDERR_FILENO) < 0) _exit(1);
+    if (shell->cwd_fd != AT_FDCWD && fchdir(shell->cwd_fd) < 0) _exit(1);
+
+    execve(path, args, envp);
+    print_error();
+    _exit(126);
+}
+
+static pid_t launch_spawn(const char *path, char **args, char **envp, int in_fd,
+                          int out_fd, int err_fd, const sigset_t *child_mask,
+                          const process_group *group) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+
+    // The process group, terminal, redirection, directory change and signal
+    // reset the fork path does by hand
+    if (group) {
+        posix_spawnattr_setpgroup(&attr, group->pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+        if (group->foreground) {
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, jobs_terminal());
+        }
+    }
+    if (in_fd >= 0) posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    if (out_fd >= 0) posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    if (err_fd >= 0) posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+    if (shell->cwd_fd != AT_FDCWD) posix_spawn_file_actions_addfchdir_np(&actions, shell->cwd_fd);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, child_mask);
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int rc = posix_spawn(&pid, path, &actions, &attr, args, envp);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rc != 0) return -1;
+    stats.spawns++;
+    return pid;
+}
+
+static pid_t launch_zygote(const char *path, char **args, char **envp, int in_fd,
+                           int out_fd, int err_fd, const sigset_t *child_mask,
+                           const process_group *group) {
+    if (zygote_available()) {
+        pid_t pid = zygote_launch(path, args, envp, in_fd, out_fd, err_fd,
+                                  group ? group->pgid : -1,
+                                  group ? group->foreground : 0);
+        if (pid >= 0 || zygote_available()) return pid;
+    }
+    // The helper has gone away, or this is a forked copy of the shell
+    return launch_spawn(path, args, envp, in_fd, out_fd, err_fd, child_mask, group);
+}
+
+// Start an external command without waiting for it. The path is resolved
+// and the redirection opened in the shell, so nothing but the exec itself
+// happens in the child. `in_fd` and `out_fd` become the child's stdin and
+// stdout, as pipeline ends; -1 stands for the context's own. A `>`
+// redirection takes precedence over `out_fd`. Returns 0 with *pid set, or
+// the exit status the command should get (1, 126 or 127) after reporting
+// the error; errors after the redirection is in place go to the redirected
+// output, as in the child. The child's environment is the shell's exported
+// variables. With `group` set the child is placed in that process group
+// (see process_group).
+int launch_command(const command *cmd, char **args, int in_fd, int out_fd,
+                   const process_group *group, pid_t *pid) {
+    const sigset_t *child_mask = events_child_mask();
+    uint64_t begin_ns = tracing ? timing_now() : 0;
+    uint64_t lookup_ns = 0;
+    uint64_t spawn_ns = 0;
+
+    // Builtin output the shell still buffers must come before the child's
+    fflush(shell->out);
+    if (in_fd < 0 && shell->fds[0] != STDIN_FILENO) in_fd = shell->fds[0];
+    if (out_fd < 0 && shell->fds[1] != STDOUT_FILENO) out_fd = shell->fds[1];
+    int child_err = shell->fds[2] != STDERR_FILENO ? shell->fds[2] : -1;
+    int redir_fd = -1;
+    if (cmd->redir_type == REDIR_OUT && cmd->redir_file != NULL) {
+        redir_fd = openat(shell->cwd_fd, cmd->redir_file,
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (redir_fd < 0) {
+            print_error();
+            if (tracing) trace_finished(args[0], 1, begin_ns);
+            return 1;
+        }
+        out_fd = child_err = redir_fd;
+    }
+    int err_fd = child_err >= 0 ? child_err : STDERR_FILENO;
+
+    int status = 0;
+    uint64_t start = phase_start();
+    const char *path = find_in_path(args[0]);
+    char **envp = vars_envp();
+    phase_end(PHASE_LOOKUP, start);
+    if (tracing) lookup_ns = timing_now();
+    if (path == NULL) {
+        print_error_fd(err_fd);
+        status = 127;
+    } else if (envp == NULL) {
+        print_error_fd(err_fd);
+        status = 1;
+    } else {
+        start = phase_start();
+        if (tracing) spawn_ns = timing_now();
+        launch_backend b = launch_get_backend();
+        if (b == LAUNCH_FORK) {
+            *pid = launch_fork(path, args, envp, in_fd, out_fd, child_err, child_mask,
+                               group);
+            if (*pid < 0) {
+                print_error();
+                status = 1;
+            }
+        } else {
+            *pid = b == LAUNCH_ZYGOTE
+                ? launch_zygote(path, args, envp, in_fd, out_fd, child_err, child_mask, group)
+                : launch_spawn(path, args, envp, in_fd, out_fd, child_err, child_mask, group);
+            if (*pid < 0) {
+                print_error_fd(err_fd);
+                status = 126;
+            }
+        }
+        // Also from here, so the next stage can join the group even if
+        // this child has not got to it yet
+        if (status == 0 && group) setpgid(*pid, group->pgid ? group->pgid : *pid);
+        phase_end(PHASE_LAUNCH, start);
+    }
+
+    if (tracing) {
+        if (status == 0) {
+            trace_launched(*pid, args[0], lookup_ns, spawn_ns, timing_now());
+        } else {
+            trace_finished(args[0], status, begin_ns);
+        }
+    }
+    if (redir_fd >= 0) close(redir_fd);
+    return status;
+}
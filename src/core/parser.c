@@ -1,17 +1,22 @@
 #include "../include/shell.h"
 #include "../include/errors.h"
+#include "../include/arena.h"
+#include "../include/scan.h"
+#include "../include/timing.h"
+#include "../include/stats.h"
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
 
-#define MAX_COMMANDS 64
-#define MAX_ARGS_PER_CMD 64
+#define INITIAL_COMMANDS 8
+#define INITIAL_ARGS 16
+#define PARSE_CACHE_SIZE 256
 
-extern shell_state g_state;
-
-static int is_operator_char(char c) {
-    return (c == '>' || c == '<' || c == '|' || c == '&' || c == ';');
+void free_commands(command_list *list) {
+    if (!list) return;
+    if (--list->refs > 0) return;
+    arena_release(list->mem);
 }
 
 static int is_double_op(char a, char b) {
@@ -23,138 +28,239 @@ static op_type token_to_op(const char *tok) {
     if (strcmp(tok, "&&") == 0) return OP_AND;
     if (strcmp(tok, "||") == 0) return OP_OR;
     if (strcmp(tok, "&") == 0) return OP_BG;
+    if (strcmp(tok, "|") == 0) return OP_PIPE;
     return OP_NONE;
 }
 
-static void strip_quotes(char *str) {
-    if (!str) return;
-    size_t len = strlen(str);
-    if (len >= 2) {
-        char first = str[0];
-        char last = str[len-1];
-        if ((first == '\'' && last == '\'') || (first == '"' && last == '"')) {
-            memmove(str, str + 1, len - 2);
-            str[len - 2] = '\0';
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// Raw word boundaries within the line being parsed
+typedef struct token_span {
+    size_t start;
+    size_t end;
+} token_span;
+
+// Turn one raw token into an unexpanded word: strip a matching pair of outer
+// quotes, then split the text into literal runs and $ references.
+static int lex_word(arena *mem, word *w, const char *line, const line_scan *ls,
+                    token_span tok) {
+    size_t from = tok.start;
+    size_t len = tok.end - tok.start;
+    if (len >= 2 && scan_test(ls, CLS_QUOTE, from) && line[tok.end - 1] == line[from]) {
+        from++;
+        len -= 2;
+    }
+
+    char *text = arena_strndup(mem, line + from, len);
+    if (!text) return -1;
+
+    // Every $ can end one literal run and start one reference
+    size_t ndollar = scan_count(ls, CLS_DOLLAR, from, from + len);
+    w->segs = arena_alloc(mem, (2 * ndollar + 1) * sizeof(word_seg));
+    if (!w->segs) return -1;
+    w->nsegs = 0;
+    if (ndollar == 0) {
+        w->segs[w->nsegs++] = (word_seg){SEG_LITERAL, text, len};
+        return 0;
+    }
+
+    size_t lit = 0;
+    size_t i = 0;
+    while (i < len) {
+        i = scan_next(ls, CLS_DOLLAR, from + i, from + len) - from;
+        if (i + 1 >= len) break;
+
+        if (i > lit) {
+            w->segs[w->nsegs++] = (word_seg){SEG_LITERAL, text + lit, i - lit};
         }
+        i++;
+
+        if (text[i] == '?') {
+            w->segs[w->nsegs++] = (word_seg){SEG_STATUS, NULL, 0};
+            i++;
+        } else if (text[i] == '$') {
+            w->segs[w->nsegs++] = (word_seg){SEG_PID, NULL, 0};
+            i++;
+        } else {
+            // A $ not followed by a name expands to nothing
+            size_t start = i;
+            while (i < len && is_name_char(text[i])) i++;
+            if (i > start) {
+                w->segs[w->nsegs++] = (word_seg){SEG_VAR, text + start, i - start};
+            }
+        }
+        lit = i;
     }
+    if (len > lit || w->nsegs == 0) {
+        w->segs[w->nsegs++] = (word_seg){SEG_LITERAL, text + lit, len - lit};
+    }
+    return 0;
 }
 
-static char *process_token(char *token) {
-    if (!token) return strdup("");
-    
-    char *token_copy = strdup(token);
-    strip_quotes(token_copy);
-    
-    if (strchr(token_copy, '$') != NULL) {
-        char *expanded = expand_variables(token_copy);
-        free(token_copy);
-        return expanded ? expanded : strdup("");
+static int token_is(const char *line, token_span tok, const char *text) {
+    size_t len = strlen(text);
+    return tok.end - tok.start == len && memcmp(line + tok.start, text, len) == 0;
+}
+
+// `time` (optionally followed by `--json`) in front of a pipeline is a
+// keyword rather than a word; only unquoted spellings count
+static int finish_command(arena *mem, command *cmd, const char *line,
+                          const line_scan *ls, token_span *args, int argc,
+                          int pipeline_start) {
+    if (pipeline_start && argc > 0 && token_is(line, args[0], "time")) {
+        cmd->timed = TIME_TEXT;
+        args++;
+        argc--;
+        if (argc > 0 && token_is(line, args[0], "--json")) {
+            cmd->timed = TIME_JSON;
+            args++;
+            argc--;
+        }
     }
-    
-    return token_copy;
+
+    cmd->words = arena_alloc(mem, (argc + 1) * sizeof(word));
+    if (!cmd->words) return -1;
+    for (int k = 0; k < argc; k++) {
+        if (lex_word(mem, &cmd->words[k], line, ls, args[k]) < 0) return -1;
+    }
+    cmd->argc = argc;
+    return 0;
+}
+
+// Double an arena-backed vector. The old copy stays in the arena until the
+// line is freed, which costs at most as much again as the final vector.
+static void *grow_vector(arena *mem, void *vec, int *cap, size_t elem_size) {
+    void *grown = arena_alloc(mem, (size_t)*cap * 2 * elem_size);
+    if (!grown) return NULL;
+    memcpy(grown, vec, (size_t)*cap * elem_size);
+    *cap *= 2;
+    return grown;
+}
+
+static void reset_command(command *cmd) {
+    cmd->words = NULL;
+    cmd->argc = 0;
+    cmd->redir_type = REDIR_NONE;
+    cmd->redir_file = NULL;
+    cmd->next_op = OP_NONE;
+    cmd->timed = TIME_OFF;
 }
 
-command *parse_line(char *line) {
-    if (!line || *line == '\0') return NULL;
+// Syntax errors are reported through `error` rather than printed, so callers
+// parsing ahead of execution can report them in order.
+command_list *parse_commands(const char *line, size_t len, int *error) {
+    if (!line || len == 0) return NULL;
     
-    char *comment = strchr(line, '#');
-    if (comment) *comment = '\0';
+    uint64_t start = timing_now();
+    stats.bytes_parsed += len;
+    arena *mem = arena_acquire();
+    if (!mem) return NULL;
     
-    char *end = line + strlen(line) - 1;
-    while (end > line && isspace((unsigned char)*end)) {
-        *end-- = '\0';
+    // Classify the whole line once; everything below walks the masks
+    line_scan ls;
+    if (scan_line(mem, line, len, &ls) < 0) {
+        arena_release(mem);
+        return NULL;
     }
     
-    char *start = line;
-    while (*start && isspace((unsigned char)*start)) start++;
-    if (*start == '\0') return NULL;
+    len = scan_next(&ls, CLS_HASH, 0, len);
+    len = scan_rtrim(&ls, CLS_SPACE, 0, len);
+    size_t i = scan_next_clear(&ls, CLS_SPACE, 0, len);
+    if (i >= len) {
+        arena_release(mem);
+        return NULL;
+    }
     
-    command *cmds = calloc(MAX_COMMANDS, sizeof(command));
-    if (!cmds) return NULL;
+    command_list *list = arena_alloc(mem, sizeof(command_list));
+    if (!list) {
+        arena_release(mem);
+        return NULL;
+    }
+    int cmd_cap = INITIAL_COMMANDS;
+    command *cmds = arena_alloc(mem, cmd_cap * sizeof(command));
+    list->cmds = cmds;
+    list->count = 0;
+    list->refs = 1;
+    list->mem = mem;
     
     int cmd_idx = 0;
-    char *args[MAX_ARGS_PER_CMD];
+    int arg_cap = INITIAL_ARGS;
+    token_span *args = arena_alloc(mem, arg_cap * sizeof(token_span));
     int arg_idx = 0;
+    if (!cmds || !args) {
+        free_commands(list);
+        return NULL;
+    }
     
-    cmds[cmd_idx].args = NULL;
-    cmds[cmd_idx].redir_type = REDIR_NONE;
-    cmds[cmd_idx].redir_file = NULL;
-    cmds[cmd_idx].next_op = OP_NONE;
-    
-    int i = 0;
-    int len = strlen(start);
+    reset_command(&cmds[cmd_idx]);
     
-    while (i < len && cmd_idx < MAX_COMMANDS - 1) {
-        while (i < len && isspace((unsigned char)start[i])) i++;
+    while (i < len) {
+        i = scan_next_clear(&ls, CLS_SPACE, i, len);
         if (i >= len) break;
         
-        if (start[i] == '>') {
+        if (line[i] == '>') {
             if (cmds[cmd_idx].redir_type != REDIR_NONE) {
-                print_error();
-                free_commands(cmds);
+                *error = 1;
+                free_commands(list);
                 return NULL;
             }
             i++;
             
-            while (i < len && isspace((unsigned char)start[i])) i++;
+            i = scan_next_clear(&ls, CLS_SPACE, i, len);
             
             if (i >= len) {
-                print_error();
-                free_commands(cmds);
+                *error = 1;
+                free_commands(list);
                 return NULL;
             }
             
-            int file_start = i;
-            while (i < len && !isspace((unsigned char)start[i]) && 
-                   !is_operator_char(start[i])) {
-                i++;
+            size_t file_start = i;
+            while (i < len && !scan_test(&ls, CLS_SPACE, i) && !scan_test(&ls, CLS_OP, i)) {
+                i = scan_next(&ls, CLS_BREAK, i + 1, len);
             }
             
             if (i == file_start) {
-                print_error();
-                free_commands(cmds);
+                *error = 1;
+                free_commands(list);
                 return NULL;
             }
             
-            char *filename = malloc(i - file_start + 1);
-            strncpy(filename, &start[file_start], i - file_start);
-            filename[i - file_start] = '\0';
-            
             cmds[cmd_idx].redir_type = REDIR_OUT;
-            cmds[cmd_idx].redir_file = filename;
+            cmds[cmd_idx].redir_file = arena_strndup(mem, &line[file_start],
+                                                     i - file_start);
             continue;
         }
         
-        if (is_operator_char(start[i])) {
+        if (scan_test(&ls, CLS_OP, i)) {
             if (arg_idx == 0 && cmds[cmd_idx].redir_type == REDIR_NONE && cmd_idx == 0) {
-                print_error();
-                free_commands(cmds);
+                *error = 1;
+                free_commands(list);
                 return NULL;
             }
             
             if (arg_idx > 0 || cmds[cmd_idx].redir_type != REDIR_NONE) {
-                args[arg_idx] = NULL;
-                cmds[cmd_idx].args = malloc((arg_idx + 1) * sizeof(char *));
-                for (int k = 0; k < arg_idx; k++) {
-                    cmds[cmd_idx].args[k] = process_token(args[k]);
-                    free(args[k]);
+                if (finish_command(mem, &cmds[cmd_idx], line, &ls, args, arg_idx,
+                                   cmd_idx == 0 || cmds[cmd_idx - 1].next_op != OP_PIPE) < 0) {
+                    free_commands(list);
+                    return NULL;
                 }
-                cmds[cmd_idx].args[arg_idx] = NULL;
                 arg_idx = 0;
             } else {
-                print_error();
-                free_commands(cmds);
+                *error = 1;
+                free_commands(list);
                 return NULL;
             }
             
             char op[3] = {0};
-            if (i+1 < len && is_double_op(start[i], start[i+1])) {
-                op[0] = start[i];
-                op[1] = start[i+1];
+            if (i+1 < len && is_double_op(line[i], line[i+1])) {
+                op[0] = line[i];
+                op[1] = line[i+1];
                 op[2] = '\0';
                 i += 2;
             } else {
-                op[0] = start[i];
+                op[0] = line[i];
                 op[1] = '\0';
                 i++;
             }
@@ -162,71 +268,125 @@ command *parse_line(char *line) {
             cmds[cmd_idx].next_op = token_to_op(op);
             cmd_idx++;
             
-            cmds[cmd_idx].args = NULL;
-            cmds[cmd_idx].redir_type = REDIR_NONE;
-            cmds[cmd_idx].redir_file = NULL;
-            cmds[cmd_idx].next_op = OP_NONE;
+            // Keep one slot spare for the terminating empty command
+            if (cmd_idx + 1 >= cmd_cap) {
+                cmds = grow_vector(mem, cmds, &cmd_cap, sizeof(command));
+                if (!cmds) {
+                    free_commands(list);
+                    return NULL;
+                }
+                list->cmds = cmds;
+            }
+            
+            reset_command(&cmds[cmd_idx]);
             continue;
         }
         
-        int arg_start = i;
-        char quote = 0;
+        // Jump from break character to break character; only quotes keep going
+        size_t arg_start = i;
         while (i < len) {
-            if (quote == 0) {
-                if (isspace((unsigned char)start[i])) break;
-                if (is_operator_char(start[i])) break;
-                if (start[i] == '\'' || start[i] == '"') {
-                    quote = start[i];
-                }
-            } else {
-                if (start[i] == quote) {
-                    quote = 0;
-                }
+            i = scan_next(&ls, CLS_BREAK, i, len);
+            if (i >= len || !scan_test(&ls, CLS_QUOTE, i)) break;
+            
+            const char *close = memchr(&line[i + 1], line[i], len - i - 1);
+            if (!close) {
+                *error = 1;
+                free_commands(list);
+                return NULL;
             }
-            i++;
-        }
-        
-        if (quote != 0) {
-            print_error();
-            free_commands(cmds);
-            return NULL;
+            i = close - line + 1;
         }
         
         if (i > arg_start) {
-            int tok_len = i - arg_start;
-            char *arg = malloc(tok_len + 1);
-            strncpy(arg, &start[arg_start], tok_len);
-            arg[tok_len] = '\0';
-            
-            if (arg_idx < MAX_ARGS_PER_CMD - 1) {
-                args[arg_idx++] = arg;
-            } else {
-                free(arg);
+            if (arg_idx >= arg_cap) {
+                args = grow_vector(mem, args, &arg_cap, sizeof(token_span));
+                if (!args) {
+                    free_commands(list);
+                    return NULL;
+                }
             }
+            args[arg_idx++] = (token_span){arg_start, i};
         }
     }
     
     if (arg_idx > 0 || cmds[cmd_idx].redir_type != REDIR_NONE) {
-        args[arg_idx] = NULL;
-        cmds[cmd_idx].args = malloc((arg_idx + 1) * sizeof(char *));
-        for (int k = 0; k < arg_idx; k++) {
-            if (args[k]) {
-                cmds[cmd_idx].args[k] = process_token(args[k]);
-                free(args[k]);
-            }
+        if (finish_command(mem, &cmds[cmd_idx], line, &ls, args, arg_idx,
+                           cmd_idx == 0 || cmds[cmd_idx - 1].next_op != OP_PIPE) < 0) {
+            free_commands(list);
+            return NULL;
         }
-        cmds[cmd_idx].args[arg_idx] = NULL;
         cmd_idx++;
-    } else if (cmd_idx > 0) {
-        print_error();
-        free_commands(cmds);
+    } else if (cmd_idx > 0 && cmds[cmd_idx - 1].next_op != OP_BG) {
+        // Only '&' may end a line: `cmd &` runs it in the background
+        *error = 1;
+        free_commands(list);
         return NULL;
     }
     
-    cmds[cmd_idx].args = NULL;
-    cmds[cmd_idx].redir_type = REDIR_NONE;
-    cmds[cmd_idx].redir_file = NULL;
-    cmds[cmd_idx].next_op = OP_NONE;
+    reset_command(&cmds[cmd_idx]);
+    list->count = cmd_idx;
+    list->parse_ns = timing_now() - start;
+    
+    return list;
+}
+
+command_list *parse_line(const char *line, size_t len) {
+    int error = 0;
+    command_list *cmds = parse_commands(line, len, &error);
+    if (error) print_error();
+    return cmds;
+}
+
+// Parsed-line cache for batch and pipe mode, where generated scripts repeat
+// the same lines over and over. Parsed lines carry no expanded values, so a
+// hit can be executed as-is. Direct-mapped on the line hash; a collision just
+// replaces the slot. One cache per thread, so contexts on different threads
+// never share entries.
+typedef struct parse_cache_entry {
+    unsigned long hash;
+    char *line;
+    size_t len;
+    command_list *cmds;
+} parse_cache_entry;
+
+static _Thread_local parse_cache_entry parse_cache[PARSE_CACHE_SIZE];
+
+static unsigned long hash_line(const char *line, size_t len) {
+    unsigned long h = 14695981039346656037UL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)line[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+command_list *parse_line_cached(const char *line, size_t len, int *error) {
+    *error = 0;
+    if (!line || len == 0) return NULL;
+    
+    unsigned long hash = hash_line(line, len);
+    parse_cache_entry *e = &parse_cache[hash % PARSE_CACHE_SIZE];
+    if (e->cmds && e->hash == hash && e->len == len && memcmp(e->line, line, len) == 0) {
+        e->cmds->refs++;
+        stats.parse_cache_hits++;
+        return e->cmds;
+    }
     
+    command_list *cmds = parse_commands(line, len, error);
+    if (!cmds) return NULL;
+    
+    char *key = malloc(len);
+    if (!key) return cmds;
+    memcpy(key, line, len);
+    
+    if (e->cmds) {
+        free_commands(e->cmds);
+        free(e->line);
+    }
+    e->hash = hash;
+    e->line = key;
+    e->len = len;
+    e->cmds = cmds;
+    cmds->refs++;
     return cmds;
 }
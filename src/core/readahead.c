@@ -0,0 +1,78 @@
+#include "../include/readahead.h"
+#include "../include/timing.h"
+#include <stddef.h>
+
+// The queue the executor's wait hook fills; only one is active at a time
+// on each thread
+static _Thread_local readahead *active = NULL;
+
+// Read and parse one line into the queue. Returns 0 once the queue is full
+// or the input is exhausted.
+static int readahead_fill(readahead *ra) {
+    if (ra->eof || ra->count == READAHEAD_DEPTH) return 0;
+
+    size_t len;
+    char *line = reader_next(ra->reader, &len);
+    if (!line) {
+        ra->eof = 1;
+        return 0;
+    }
+    ra->lineno++;
+    uint64_t read_ns = tracing ? timing_now() : 0;
+
+    int error;
+    command_list *cmds = parse_line_cached(line, len, &error);
+    if (cmds || error) {
+        readahead_entry *e = &ra->slots[(ra->head + ra->count) % READAHEAD_DEPTH];
+        e->cmds = cmds;
+        e->error = error;
+        e->ctx.lineno = ra->lineno;
+        e->ctx.read_ns = read_ns;
+        e->ctx.parse_ns = tracing ? timing_now() : 0;
+        e->ctx.expand_ns = 0;
+        ra->count++;
+    }
+    return 1;
+}
+
+// Never block on the input from here: a slow producer must not delay
+// reaping the child we are waiting for
+static int readahead_hook(void) {
+    if (!active || !reader_ready(active->reader)) return 0;
+    return readahead_fill(active);
+}
+
+void readahead_start(readahead *ra, line_reader *reader) {
+    ra->reader = reader;
+    ra->head = 0;
+    ra->count = 0;
+    ra->eof = 0;
+    ra->lineno = 0;
+    active = ra;
+    set_wait_hook(readahead_hook);
+}
+
+readahead_status readahead_next(readahead *ra, command_list **cmds) {
+    while (ra->count == 0) {
+        if (!readahead_fill(ra)) return READAHEAD_EOF;
+    }
+
+    readahead_entry *e = &ra->slots[ra->head];
+    ra->head = (ra->head + 1) % READAHEAD_DEPTH;
+    ra->count--;
+    *cmds = e->cmds;
+    ra->current = e->ctx;
+    return e->error ? READAHEAD_ERROR : READAHEAD_LINE;
+}
+
+void readahead_stop(readahead *ra) {
+    command_list *cmds;
+    while (ra->count > 0) {
+        readahead_next(ra, &cmds);
+        free_commands(cmds);
+    }
+    if (active == ra) {
+        active = NULL;
+        set_wait_hook(NULL);
+    }
+}
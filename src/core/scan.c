@@ -0,0 +1,186 @@
+#include "../include/scan.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static inline uint64_t class_bits(unsigned char c, char_class cls) {
+    switch (cls) {
+        case CLS_SPACE:  return c == ' ' || (c >= '\t' && c <= '\r');
+        case CLS_OP:     return c == ';' || c == '&' || c == '|' || c == '<' || c == '>';
+        case CLS_QUOTE:  return c == '\'' || c == '"';
+        case CLS_HASH:   return c == '#';
+        case CLS_DOLLAR: return c == '$';
+        default:         return 0;
+    }
+}
+
+// Classify bytes [from, to) one at a time; used for the tail and on targets
+// without SIMD. All bytes must fall in the same mask word.
+static void scan_scalar(const char *line, size_t from, size_t to, line_scan *ls) {
+    for (size_t i = from; i < to; i++) {
+        unsigned char c = (unsigned char)line[i];
+        uint64_t bit = 1ULL << (i % 64);
+        for (int cls = CLS_SPACE; cls < CLS_BREAK; cls++) {
+            if (class_bits(c, cls)) ls->mask[cls][i / 64] |= bit;
+        }
+    }
+}
+
+#ifdef SCAN_X86
+// One 16-byte lane: every class as a 16-bit movemask
+static inline void classify_sse2(const char *p, uint32_t out[CLS_BREAK]) {
+    __m128i c = _mm_loadu_si128((const __m128i *)p);
+    // isspace(): ' ' or '\t'..'\r', the latter as (c - '\t') <= 4 unsigned
+    __m128i rel = _mm_sub_epi8(c, _mm_set1_epi8('\t'));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(rel, _mm_set1_epi8(4)), rel);
+    __m128i sp = _mm_or_si128(ctl, _mm_cmpeq_epi8(c, _mm_set1_epi8(' ')));
+    __m128i op = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(';')),
+                     _mm_cmpeq_epi8(c, _mm_set1_epi8('&'))),
+        _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('|')),
+                     _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('<')),
+                                  _mm_cmpeq_epi8(c, _mm_set1_epi8('>')))));
+    __m128i qt = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\'')),
+                              _mm_cmpeq_epi8(c, _mm_set1_epi8('"')));
+    out[CLS_SPACE] = (uint32_t)_mm_movemask_epi8(sp);
+    out[CLS_OP] = (uint32_t)_mm_movemask_epi8(op);
+    out[CLS_QUOTE] = (uint32_t)_mm_movemask_epi8(qt);
+    out[CLS_HASH] = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('#')));
+    out[CLS_DOLLAR] = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('$')));
+}
+
+static void scan_blocks_sse2(const char *line, size_t nblocks, line_scan *ls) {
+    for (size_t w = 0; w < nblocks; w++) {
+        uint64_t acc[CLS_BREAK] = {0};
+        for (int lane = 0; lane < 4; lane++) {
+            uint32_t bits[CLS_BREAK];
+            classify_sse2(line + w * 64 + lane * 16, bits);
+            for (int cls = CLS_SPACE; cls < CLS_BREAK; cls++) {
+                acc[cls] |= (uint64_t)bits[cls] << (lane * 16);
+            }
+        }
+        for (int cls = CLS_SPACE; cls < CLS_BREAK; cls++) {
+            ls->mask[cls][w] = acc[cls];
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void scan_blocks_avx2(const char *line, size_t nblocks, line_scan *ls) {
+    for (size_t w = 0; w < nblocks; w++) {
+        uint64_t acc[CLS_BREAK] = {0};
+        for (int lane = 0; lane < 2; lane++) {
+            __m256i c = _mm256_loadu_si256((const __m256i *)(line + w * 64 + lane * 32));
+            __m256i rel = _mm256_sub_epi8(c, _mm256_set1_epi8('\t'));
+            __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(rel, _mm256_set1_epi8(4)), rel);
+            __m256i sp = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')));
+            __m256i op = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(';')),
+                                _mm256_cmpeq_epi8(c, _mm256_set1_epi8('&'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('|')),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('<')),
+                                                _mm256_cmpeq_epi8(c, _mm256_set1_epi8('>')))));
+            __m256i qt = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\'')),
+                                         _mm256_cmpeq_epi8(c, _mm256_set1_epi8('"')));
+            __m256i hs = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('#'));
+            __m256i dl = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('$'));
+            int shift = lane * 32;
+            acc[CLS_SPACE] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(sp) << shift;
+            acc[CLS_OP] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << shift;
+            acc[CLS_QUOTE] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(qt) << shift;
+            acc[CLS_HASH] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(hs) << shift;
+            acc[CLS_DOLLAR] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(dl) << shift;
+        }
+        for (int cls = CLS_SPACE; cls < CLS_BREAK; cls++) {
+            ls->mask[cls][w] = acc[cls];
+        }
+    }
+}
+
+static int have_avx2 = -1;
+#endif
+
+// Build every class mask for line[0, len) in a single pass
+int scan_line(arena *mem, const char *line, size_t len, line_scan *ls) {
+    size_t nwords = len / 64 + 1;
+    ls->len = len;
+    for (int cls = 0; cls < CLS_COUNT; cls++) {
+        ls->mask[cls] = arena_calloc(mem, nwords, sizeof(uint64_t));
+        if (!ls->mask[cls]) return -1;
+    }
+
+    size_t nblocks = len / 64;
+#ifdef SCAN_X86
+    if (have_avx2 < 0) {
+        __builtin_cpu_init();
+        have_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    if (have_avx2) {
+        scan_blocks_avx2(line, nblocks, ls);
+    } else {
+        scan_blocks_sse2(line, nblocks, ls);
+    }
+#else
+    for (size_t w = 0; w < nblocks; w++) {
+        scan_scalar(line, w * 64, w * 64 + 64, ls);
+    }
+#endif
+    scan_scalar(line, nblocks * 64, len, ls);
+
+    for (size_t w = 0; w < nwords; w++) {
+        ls->mask[CLS_BREAK][w] = ls->mask[CLS_SPACE][w] | ls->mask[CLS_OP][w] |
+                                 ls->mask[CLS_QUOTE][w];
+    }
+    return 0;
+}
+
+// Bits of word w that fall inside [from, to)
+static inline uint64_t range_bits(size_t w, size_t from, size_t to) {
+    uint64_t bits = ~0ULL;
+    if (w == from / 64) bits &= ~0ULL << (from % 64);
+    if (w == to / 64) bits &= (to % 64) ? ~0ULL >> (64 - to % 64) : 0;
+    return bits;
+}
+
+// First byte in [from, to) of class `cls`, or `to` if there is none
+size_t scan_next(const line_scan *ls, char_class cls, size_t from, size_t to) {
+    if (from >= to) return to;
+    for (size_t w = from / 64; w <= (to - 1) / 64; w++) {
+        uint64_t bits = ls->mask[cls][w] & range_bits(w, from, to);
+        if (bits) return w * 64 + (size_t)__builtin_ctzll(bits);
+    }
+    return to;
+}
+
+// First byte in [from, to) NOT of class `cls`, or `to` if there is none
+size_t scan_next_clear(const line_scan *ls, char_class cls, size_t from, size_t to) {
+    if (from >= to) return to;
+    for (size_t w = from / 64; w <= (to - 1) / 64; w++) {
+        uint64_t bits = ~ls->mask[cls][w] & range_bits(w, from, to);
+        if (bits) return w * 64 + (size_t)__builtin_ctzll(bits);
+    }
+    return to;
+}
+
+// End of [from, to) once trailing bytes of class `cls` are dropped
+size_t scan_rtrim(const line_scan *ls, char_class cls, size_t from, size_t to) {
+    if (from >= to) return from;
+    for (size_t w = (to - 1) / 64 + 1; w-- > from / 64;) {
+        uint64_t bits = ~ls->mask[cls][w] & range_bits(w, from, to);
+        if (bits) return w * 64 + 64 - (size_t)__builtin_clzll(bits);
+    }
+    return from;
+}
+
+// Number of bytes of class `cls` in [from, to)
+size_t scan_count(const line_scan *ls, char_class cls, size_t from, size_t to) {
+    size_t n = 0;
+    if (from >= to) return 0;
+    for (size_t w = from / 64; w <= (to - 1) / 64; w++) {
+        n += (size_t)__builtin_popcountll(ls->mask[cls][w] & range_bits(w, from, to));
+    }
+    return n;
+}
@@ -1,37 +1,137 @@
+#define _GNU_SOURCE
 #include "../include/shell.h"
+#include "../include/errors.h"
+#include "../include/events.h"
+#include "../include/arena.h"
+#include "../include/alias.h"
+#include "../include/jobs.h"
+#include "../include/vars.h"
+#include "../include/stats.h"
+#include "../include/launch.h"
+#include "../include/zygote.h"
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <fcntl.h>
 
-shell_state g_state;
+shell_state shell_process = {.cwd_fd = AT_FDCWD, .fds = {0, 1, 2}};
+_Thread_local shell_state *shell = &shell_process;
+
+extern char **environ;
+
+// Set up a context: path /bin, the process's working directory and stdio,
+// and `envp` as its exported variables. The process's own context uses the
+// working directory itself; any other holds on to it with a descriptor, so
+// its cd does not move the process. Returns -1 if out of memory.
+int shell_ctx_init(shell_state *ctx, char **envp) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->cwd_fd = AT_FDCWD;
+    for (int i = 0; i < 3; i++) ctx->fds[i] = i;
+    ctx->out = stdout;
+    ctx->err = stderr;
 
-void init_shell_state(void) {
     // Default path: /bin
-    g_state.path_count = 1;
-    g_state.path_list = malloc(2 * sizeof(char *));
-    g_state.path_list[0] = strdup("/bin");
-    g_state.path_list[1] = NULL;
+    ctx->path_count = 1;
+    ctx->path_list = malloc(2 * sizeof(char *));
+    if (!ctx->path_list) return -1;
+    ctx->path_list[0] = strdup("/bin");
+    ctx->path_list[1] = NULL;
 
     // PWD and OLDPWD
     char cwd[PATH_MAX];
     if (getcwd(cwd, sizeof(cwd))) {
-        g_state.pwd = strdup(cwd);
-        g_state.oldpwd = strdup(cwd);
+        ctx->pwd = strdup(cwd);
+        ctx->oldpwd = strdup(cwd);
     } else {
-        g_state.pwd = strdup("/");
-        g_state.oldpwd = strdup("/");
+        ctx->pwd = strdup("/");
+        ctx->oldpwd = strdup("/");
     }
+    if (ctx != &shell_process) {
+        ctx->cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (ctx->cwd_fd < 0) return -1;
+    }
+
+    ctx->exit_status = 0;
+    ctx->shell_pid = getpid();
 
-    g_state.exit_status = 0;
-    g_state.shell_pid = getpid();
+    // From here on the shell owns its variables; environ is not touched
+    ctx->vars = vars_store_new(envp);
+    ctx->aliases = alias_store_new();
+    ctx->hash = command_hash_new();
+    ctx->jobs = job_table_new();
+    ctx->arenas = arena_pool_new();
+    if (!ctx->path_list[0] || !ctx->pwd || !ctx->oldpwd || !ctx->vars ||
+        !ctx->aliases || !ctx->hash || !ctx->jobs || !ctx->arenas) {
+        return -1;
+    }
+    return 0;
 }
 
-void free_shell_state(void) {
-    for (int i = 0; i < g_state.path_count; i++) {
-        free(g_state.path_list[i]);
+// Release everything a context owns. Its stdio is closed unless it is the
+// process's own.
+void shell_ctx_free(shell_state *ctx) {
+    for (int i = 0; i < ctx->path_count && ctx->path_list; i++) {
+        free(ctx->path_list[i]);
+    }
+    free(ctx->path_list);
+    free(ctx->pwd);
+    free(ctx->oldpwd);
+    free(ctx->scratch);
+
+    // Alias bodies and parsed lines hand their arenas back to the current
+    // context's pool
+    shell_state *outer = shell;
+    shell = ctx;
+    alias_store_free(ctx->aliases);
+    vars_store_free(ctx->vars);
+    command_hash_free(ctx->hash);
+    job_table_free(ctx->jobs);
+    shell = outer;
+    arena_pool_free(ctx->arenas);
+
+    if (ctx->cwd_fd >= 0) close(ctx->cwd_fd);
+    if (ctx->out && ctx->out != stdout) fclose(ctx->out);
+    if (ctx->err && ctx->err != stderr) fclose(ctx->err);
+    if (ctx->fds[0] != STDIN_FILENO) close(ctx->fds[0]);
+    ctx->path_list = NULL;
+    ctx->path_count = 0;
+    ctx->pwd = ctx->oldpwd = ctx->scratch = NULL;
+    ctx->vars = NULL;
+    ctx->aliases = NULL;
+    ctx->hash = NULL;
+    ctx->jobs = NULL;
+    ctx->arenas = NULL;
+}
+
+// A forked copy of the shell has moved the context's stdio onto its own
+// 0, 1 and 2; from now on the context writes there
+void shell_use_stdio(void) {
+    for (int i = 0; i < 3; i++) shell->fds[i] = i;
+    if (shell == &shell_process) {
+        shell->out = stdout;
+        shell->err = stderr;
+        return;
     }
-    free(g_state.path_list);
-    free(g_state.pwd);
-    free(g_state.oldpwd);
+    // Not stdout itself, which may hold the host's unwritten output
+    FILE *out = fdopen(STDOUT_FILENO, "w");
+    FILE *err = fdopen(STDERR_FILENO, "w");
+    if (err) setvbuf(err, NULL, _IONBF, 0);
+    shell->out = out ? out : stdout;
+    shell->err = err ? err : stderr;
+}
+
+void init_shell_state(void) {
+    if (shell_ctx_init(&shell_process, environ) < 0) print_error();
+    stats_init();
+
+    // While the shell is still small, and before signals are blocked
+    if (launch_get_backend() == LAUNCH_ZYGOTE && zygote_start() < 0) print_error();
+
+    // Before any child exists, so no SIGCHLD can be missed
+    if (events_init(1) < 0) print_error();
+}
+
+void free_shell_state(void) {
+    shell_ctx_free(&shell_process);
 }
@@ -0,0 +1,29 @@
+#include "../include/stats.h"
+#include "../include/vars.h"
+#include <stdlib.h>
+#include <string.h>
+
+_Thread_local shell_stats stats;
+
+void stats_print(FILE *out) {
+#define X(field, label) fprintf(out, "%-24s %lu\n", label, stats.field);
+    STATS_COUNTERS(X)
+#undef X
+}
+
+void stats_reset(void) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+static void stats_at_exit(void) {
+    fflush(stdout);
+    stats_print(stderr);
+}
+
+// With OSHELL_STATS set in the shell's starting environment the counters
+// are dumped on stderr when it exits. Forked stages leave with _exit() and
+// do not dump.
+void stats_init(void) {
+    const char *value = vars_get("OSHELL_STATS");
+    if (value && *value && strcmp(value, "0") != 0) atexit(stats_at_exit);
+}
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include "../include/timing.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+_Thread_local time_report *open_reports = NULL;
+
+static const char *phase_names[PHASE_COUNT] = {"parse", "expand", "lookup", "launch"};
+
+uint64_t timing_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void phase_end(shell_phase phase, uint64_t start) {
+    if (start == 0) return;
+    uint64_t elapsed = timing_now() - start;
+    for (time_report *r = open_reports; r; r = r->outer) {
+        r->phase_ns[phase] += elapsed;
+    }
+}
+
+static void timeval_add(struct timeval *sum, const struct timeval *tv) {
+    sum->tv_sec += tv->tv_sec;
+    sum->tv_usec += tv->tv_usec;
+    if (sum->tv_usec >= 1000000) {
+        sum->tv_sec++;
+        sum->tv_usec -= 1000000;
+    }
+}
+
+static void timeval_sub(struct timeval *diff, const struct timeval *tv) {
+    diff->tv_sec -= tv->tv_sec;
+    diff->tv_usec -= tv->tv_usec;
+    if (diff->tv_usec < 0) {
+        diff->tv_sec--;
+        diff->tv_usec += 1000000;
+    }
+}
+
+// Counters add up; the peak RSS is the largest of any one process
+void rusage_add(struct rusage *sum, const struct rusage *ru) {
+    timeval_add(&sum->ru_utime, &ru->ru_utime);
+    timeval_add(&sum->ru_stime, &ru->ru_stime);
+    if (ru->ru_maxrss > sum->ru_maxrss) sum->ru_maxrss = ru->ru_maxrss;
+    sum->ru_minflt += ru->ru_minflt;
+    sum->ru_majflt += ru->ru_majflt;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+void timing_child_reaped(const struct rusage *ru) {
+    for (time_report *r = open_reports; r; r = r->outer) {
+        rusage_add(&r->children, ru);
+    }
+}
+
+// The shell's own usage: the process's, or in a library context the
+// calling thread's, since other threads run other contexts
+static void self_usage(struct rusage *ru) {
+    getrusage(shell == &shell_process ? RUSAGE_SELF : RUSAGE_THREAD, ru);
+}
+
+void timing_begin(time_report *r) {
+    memset(r, 0, sizeof(*r));
+    self_usage(&r->self);
+    r->outer = open_reports;
+    open_reports = r;
+    r->start_ns = timing_now();
+}
+
+// Close the innermost report and print it. CPU time, faults and context
+// switches cover the children and the shell itself; the peak RSS is the
+// children's, since the shell's own never goes down.
+void timing_end(time_report *r, uint64_t parse_ns, time_format format) {
+    uint64_t real_ns = timing_now() - r->start_ns;
+    open_reports = r->outer;
+
+    struct rusage self;
+    self_usage(&self);
+    timeval_sub(&self.ru_utime, &r->self.ru_utime);
+    timeval_sub(&self.ru_stime, &r->self.ru_stime);
+    self.ru_minflt -= r->self.ru_minflt;
+    self.ru_majflt -= r->self.ru_majflt;
+    self.ru_nvcsw -= r->self.ru_nvcsw;
+    self.ru_nivcsw -= r->self.ru_nivcsw;
+    self.ru_maxrss = 0;
+
+    struct rusage usage = r->children;
+    rusage_add(&usage, &self);
+    r->phase_ns[PHASE_PARSE] += parse_ns;
+    timing_print(format, real_ns, &usage, r->phase_ns);
+}
+
+static double seconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+// Print a report to the shell's stderr; `phase_ns` may be NULL when the
+// shell's own phases were not measured
+void timing_print(time_format format, uint64_t real_ns, const struct rusage *usage,
+                  const uint64_t *phase_ns) {
+    fflush(shell->out);
+    FILE *err = shell->err;
+    if (format == TIME_JSON) {
+        fprintf(err, "{\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+                "\"minflt\":%ld,\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld",
+                real_ns / 1e9, seconds(&usage->ru_utime), seconds(&usage->ru_stime),
+                usage->ru_maxrss, usage->ru_minflt, usage->ru_majflt,
+                usage->ru_nvcsw, usage->ru_nivcsw);
+        if (phase_ns) {
+            fprintf(err, ",\"shell\":{");
+            for (int p = 0; p < PHASE_COUNT; p++) {
+                fprintf(err, "%s\"%s\":%.6f", p ? "," : "", phase_names[p], phase_ns[p] / 1e9);
+            }
+            fprintf(err, "}");
+        }
+        fprintf(err, "}\n");
+        return;
+    }
+
+    fprintf(err, "real\t%.3fs\n", real_ns / 1e9);
+    fprintf(err, "user\t%.3fs\n", seconds(&usage->ru_utime));
+    fprintf(err, "sys\t%.3fs\n", seconds(&usage->ru_stime));
+    fprintf(err, "maxrss\t%ld KiB\n", usage->ru_maxrss);
+    fprintf(err, "faults\t%ld minor, %ld major\n", usage->ru_minflt, usage->ru_majflt);
+    fprintf(err, "ctxsw\t%ld voluntary, %ld involuntary\n", usage->ru_nvcsw, usage->ru_nivcsw);
+    if (phase_ns) {
+        fprintf(err, "shell\t");
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            fprintf(err, "%s%s %.6fs", p ? ", " : "", phase_names[p], phase_ns[p] / 1e9);
+        }
+        fprintf(err, "\n");
+    }
+}
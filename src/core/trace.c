@@ -0,0 +1,164 @@
+#include "../include/trace.h"
+#include "../include/timing.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+#define TRACE_RECORD_MAX 1024
+#define TRACE_NAME_MAX 256
+#define TRACE_PENDING_INITIAL 16
+
+_Thread_local int tracing = 0;
+_Thread_local trace_context trace_current;
+
+// Records are formatted straight into a large buffer and written out a block
+// of whole records at a time. Each writer has a buffer of its own: the
+// thread that opened the trace, and every forked copy of the shell, which
+// starts with an empty one. The file is opened O_APPEND, so the blocks of
+// concurrent writers land one after another, never over each other.
+static int trace_fd = -1;
+static _Thread_local char *trace_buf = NULL;
+static _Thread_local size_t trace_used = 0;
+
+// A launched child whose record is completed when it is reaped
+typedef struct trace_pending {
+    pid_t pid;
+    trace_context ctx;
+    uint64_t t[TRACE_POINTS];
+    char name[TRACE_NAME_MAX];
+} trace_pending;
+
+static _Thread_local trace_pending *pending = NULL;
+static _Thread_local int pending_count = 0;
+static _Thread_local int pending_cap = 0;
+
+static void trace_flush(void) {
+    size_t done = 0;
+    while (done < trace_used) {
+        ssize_t n = write(trace_fd, trace_buf + done, trace_used - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += n;
+    }
+    trace_used = 0;
+}
+
+int trace_open(const char *path) {
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd < 0) return -1;
+    trace_buf = malloc(TRACE_BUFFER_SIZE);
+    if (!trace_buf) {
+        close(trace_fd);
+        trace_fd = -1;
+        return -1;
+    }
+    tracing = 1;
+    // The modes and `exit` leave through exit()
+    atexit(trace_close);
+    return 0;
+}
+
+void trace_close(void) {
+    if (!tracing) return;
+    trace_flush();
+    close(trace_fd);
+    free(trace_buf);
+    free(pending);
+    trace_fd = -1;
+    trace_buf = NULL;
+    pending = NULL;
+    pending_count = pending_cap = 0;
+    tracing = 0;
+}
+
+// A forked copy of the shell traces what it runs itself. It must not write
+// the parent's buffered records again, and the parent's children are not
+// its to report. It writes its own before it leaves, with trace_close().
+void trace_child_reset(void) {
+    trace_used = 0;
+    pending_count = 0;
+}
+
+// Command names are the only strings in a record
+static size_t json_string(char *out, size_t cap, const char *s) {
+    size_t n = 0;
+    out[n++] = '"';
+    for (; *s && n + 8 < cap; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            out[n++] = '\\';
+            out[n++] = c;
+        } else if (c < 0x20) {
+            n += snprintf(out + n, cap - n, "\\u%04x", c);
+        } else {
+            out[n++] = c;
+        }
+    }
+    out[n++] = '"';
+    return n;
+}
+
+static void emit(const char *name, pid_t pid, int status, const trace_context *ctx,
+                 const uint64_t *t) {
+    if (trace_used + TRACE_RECORD_MAX > TRACE_BUFFER_SIZE) trace_flush();
+
+    char *out = trace_buf + trace_used;
+    size_t n = snprintf(out, TRACE_RECORD_MAX, "{\"line\":%ld,\"cmd\":", ctx->lineno);
+    n += json_string(out + n, TRACE_NAME_MAX + 8, name);
+    n += snprintf(out + n, TRACE_RECORD_MAX - n,
+                  ",\"pid\":%d,\"status\":%d,\"read\":%" PRIu64 ",\"parse\":%" PRIu64
+                  ",\"expand\":%" PRIu64 ",\"lookup\":%" PRIu64 ",\"spawn\":%" PRIu64
+                  ",\"exec\":%" PRIu64 ",\"reap\":%" PRIu64 "}\n",
+                  (int)pid, status, ctx->read_ns, ctx->parse_ns, ctx->expand_ns,
+                  t[TRACE_LOOKUP], t[TRACE_SPAWN], t[TRACE_EXEC], t[TRACE_REAP]);
+    trace_used += n;
+}
+
+void trace_launched(pid_t pid, const char *name, uint64_t lookup_ns,
+                    uint64_t spawn_ns, uint64_t exec_ns) {
+    if (pending_count == pending_cap) {
+        int cap = pending_cap ? pending_cap * 2 : TRACE_PENDING_INITIAL;
+        trace_pending *grown = realloc(pending, cap * sizeof(trace_pending));
+        if (!grown) return;
+        pending = grown;
+        pending_cap = cap;
+    }
+    trace_pending *p = &pending[pending_count++];
+    memset(p->t, 0, sizeof(p->t));
+    p->pid = pid;
+    p->ctx = trace_current;
+    p->t[TRACE_LOOKUP] = lookup_ns;
+    p->t[TRACE_SPAWN] = spawn_ns;
+    p->t[TRACE_EXEC] = exec_ns;
+    snprintf(p->name, sizeof(p->name), "%s", name);
+}
+
+// Status as a shell reports it: the exit code, or 128 plus the signal
+void trace_reaped(pid_t pid, int status) {
+    for (int i = 0; i < pending_count; i++) {
+        if (pending[i].pid != pid) continue;
+        pending[i].t[TRACE_REAP] = timing_now();
+        int code = WIFEXITED(status) ? WEXITSTATUS(status)
+                 : WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
+        emit(pending[i].name, pid, code, &pending[i].ctx, pending[i].t);
+        pending[i] = pending[--pending_count];
+        return;
+    }
+}
+
+// A command that ran in the shell itself, or failed to launch: no pid, and
+// its end stands in for the reap
+void trace_finished(const char *name, int status, uint64_t start_ns) {
+    uint64_t t[TRACE_POINTS] = {0};
+    t[TRACE_SPAWN] = start_ns;
+    t[TRACE_REAP] = timing_now();
+    emit(name, 0, status, &trace_current, t);
+}
@@ -1,15 +1,176 @@
 #include "../include/utils.h"
-#include <stdio.h>
-#include <string.h>
+#include "../include/stats.h"
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
 
-#define BUFFER_SIZE 1024
+line_reader *reader_open(int fd) {
+    line_reader *r = malloc(sizeof(line_reader));
+    if (!r) return NULL;
+    r->buf = malloc(READER_BLOCK_SIZE);
+    if (!r->buf) {
+        free(r);
+        return NULL;
+    }
+    r->fd = fd;
+    r->owns_fd = 0;
+    r->mapped = 0;
+    r->cap = READER_BLOCK_SIZE;
+    r->start = 0;
+    r->scanned = 0;
+    r->end = 0;
+    r->eof = 0;
+    r->wait_input = NULL;
+    return r;
+}
 
-char *read_line(FILE *stream) {
-    static char buffer[BUFFER_SIZE];
-    if (fgets(buffer, BUFFER_SIZE, stream) == NULL) {
+// Regular files are mapped whole so lines are parsed straight out of the
+// page cache; anything else (FIFOs, devices, empty files) is streamed.
+line_reader *reader_open_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            line_reader *r = malloc(sizeof(line_reader));
+            if (!r) {
+                munmap(map, st.st_size);
+                close(fd);
+                return NULL;
+            }
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            r->fd = -1;
+            r->owns_fd = 0;
+            r->mapped = 1;
+            r->buf = map;
+            r->cap = st.st_size;
+            r->start = 0;
+            r->scanned = 0;
+            r->end = st.st_size;
+            r->eof = 1;
+            r->wait_input = NULL;
+            return r;
+        }
+    }
+
+    line_reader *r = reader_open(fd);
+    if (!r) {
+        close(fd);
         return NULL;
     }
-    buffer[strcspn(buffer, "\n")] = '\0';
-    return buffer;
+    r->owns_fd = 1;
+    return r;
+}
+
+// Make room for at least one more block after the buffered partial line
+static int reader_fill(line_reader *r) {
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (r->cap - r->end < READER_BLOCK_SIZE) {
+        char *grown = realloc(r->buf, r->cap * 2);
+        if (!grown) return -1;
+        r->buf = grown;
+        r->cap *= 2;
+    }
+
+    if (r->wait_input) r->wait_input(r->fd);
+
+    ssize_t n;
+    do {
+        n = read(r->fd, r->buf + r->end, r->cap - r->end);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        r->eof = 1;
+        return n < 0 ? -1 : 0;
+    }
+    r->end += n;
+    return 0;
+}
+
+char *reader_next(line_reader *r, size_t *len) {
+    while (1) {
+        char *from = r->buf + r->start + r->scanned;
+        char *nl = memchr(from, '\n', r->end - r->start - r->scanned);
+        if (nl) {
+            char *line = r->buf + r->start;
+            *len = nl - line;
+            r->start = nl + 1 - r->buf;
+            r->scanned = 0;
+            stats.lines_read++;
+            return line;
+        }
+        r->scanned = r->end - r->start;
+
+        if (r->eof) {
+            if (r->start == r->end) return NULL;
+            char *line = r->buf + r->start;
+            *len = r->end - r->start;
+            r->start = r->end;
+            r->scanned = 0;
+            stats.lines_read++;
+            return line;
+        }
+
+        if (reader_fill(r) < 0 && !r->eof) return NULL;
+    }
+}
+
+// Whether reader_next() can make progress without waiting on the input
+int reader_ready(line_reader *r) {
+    if (r->eof) return 1;
+    if (memchr(r->buf + r->start + r->scanned, '\n', r->end - r->start - r->scanned)) {
+        return 1;
+    }
+    struct pollfd pfd = {r->fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+void reader_close(line_reader *r) {
+    if (!r) return;
+    if (r->mapped) {
+        munmap(r->buf, r->cap);
+    } else {
+        free(r->buf);
+    }
+    if (r->owns_fd) close(r->fd);
+    free(r);
+}
+
+int send_full(int sock, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
 }
@@ -0,0 +1,210 @@
+#include "../include/vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VARS_TABLE_INITIAL 64
+
+struct vars_store {
+    // Name -> variable. Open addressing with linear probing; removal shifts
+    // the rest of the probe run back instead of leaving tombstones.
+    var **table;
+    size_t table_cap;
+
+    // Variables in definition order, which is the order children see them in
+    var **list;
+    size_t count;
+    size_t list_cap;
+
+    // Environment for children, valid until the next change
+    char **envp_cache;
+    int envp_dirty;
+};
+
+static size_t hash_name(const char *name, size_t len) {
+    size_t h = 5381;
+    for (size_t i = 0; i < len; i++) {
+        h = h * 33 + (unsigned char)name[i];
+    }
+    return h;
+}
+
+static int var_is(const var *v, const char *name, size_t len) {
+    return v->name_len == len && memcmp(v->entry, name, len) == 0;
+}
+
+static size_t var_slot(var **table, size_t cap, const char *name, size_t len) {
+    size_t i = hash_name(name, len) & (cap - 1);
+    while (table[i] && !var_is(table[i], name, len)) {
+        i = (i + 1) & (cap - 1);
+    }
+    return i;
+}
+
+static int vars_grow(vars_store *vs) {
+    size_t cap = vs->table_cap ? vs->table_cap * 2 : VARS_TABLE_INITIAL;
+    var **table = calloc(cap, sizeof(var *));
+    if (!table) return -1;
+    for (size_t i = 0; i < vs->table_cap; i++) {
+        var *v = vs->table[i];
+        if (v) table[var_slot(table, cap, v->entry, v->name_len)] = v;
+    }
+    free(vs->table);
+    vs->table = table;
+    vs->table_cap = cap;
+    return 0;
+}
+
+const char *vars_getn(const char *name, size_t len) {
+    vars_store *vs = shell->vars;
+    if (vs->count == 0) return NULL;
+    var *v = vs->table[var_slot(vs->table, vs->table_cap, name, len)];
+    return v ? v->entry + len + 1 : NULL;
+}
+
+const char *vars_get(const char *name) {
+    return vars_getn(name, strlen(name));
+}
+
+static int set_entry(vars_store *vs, const char *name, size_t len, const char *value, int exported) {
+    size_t value_len = strlen(value);
+    char *entry = malloc(len + value_len + 2);
+    if (!entry) return -1;
+    memcpy(entry, name, len);
+    entry[len] = '=';
+    memcpy(entry + len + 1, value, value_len + 1);
+
+    // Keep the load factor at or below one half
+    if ((vs->count + 1) * 2 > vs->table_cap && vars_grow(vs) < 0) {
+        free(entry);
+        return -1;
+    }
+
+    size_t slot = var_slot(vs->table, vs->table_cap, name, len);
+    var *v = vs->table[slot];
+    if (v) {
+        free(v->entry);
+        v->entry = entry;
+        v->exported |= exported;
+    } else {
+        if (vs->count == vs->list_cap) {
+            size_t cap = vs->list_cap ? vs->list_cap * 2 : VARS_TABLE_INITIAL;
+            var **grown = realloc(vs->list, cap * sizeof(var *));
+            if (!grown) {
+                free(entry);
+                return -1;
+            }
+            vs->list = grown;
+            vs->list_cap = cap;
+        }
+        v = malloc(sizeof(var));
+        if (!v) {
+            free(entry);
+            return -1;
+        }
+        v->entry = entry;
+        v->name_len = len;
+        v->exported = exported;
+        vs->table[slot] = v;
+        vs->list[vs->count++] = v;
+    }
+    vs->envp_dirty = 1;
+    return 0;
+}
+
+// A store holding `envp`, the environment the shell was started with; every
+// entry is exported. NULL if out of memory.
+vars_store *vars_store_new(char **envp) {
+    vars_store *vs = calloc(1, sizeof(vars_store));
+    if (!vs) return NULL;
+    vs->envp_dirty = 1;
+    for (char **e = envp; e && *e; e++) {
+        const char *eq = strchr(*e, '=');
+        if (!eq || eq == *e) continue;
+        if (set_entry(vs, *e, eq - *e, eq + 1, 1) < 0) {
+            vars_store_free(vs);
+            return NULL;
+        }
+    }
+    return vs;
+}
+
+// Returns -1 for an invalid name or when out of memory
+int vars_set(const char *name, const char *value, int exported) {
+    if (name[0] == '\0' || strchr(name, '=') != NULL) return -1;
+    return set_entry(shell->vars, name, strlen(name), value, exported);
+}
+
+void vars_unset(const char *name) {
+    vars_store *vs = shell->vars;
+    size_t len = strlen(name);
+    if (vs->count == 0) return;
+    size_t i = var_slot(vs->table, vs->table_cap, name, len);
+    var *v = vs->table[i];
+    if (!v) return;
+
+    // Close the gap so later entries of the probe run stay reachable
+    size_t mask = vs->table_cap - 1;
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        var *next = vs->table[j];
+        if (!next) break;
+        size_t home = hash_name(next->entry, next->name_len) & mask;
+        // Move `next` into the gap unless its home lies cyclically in (i, j]
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            vs->table[i] = next;
+            i = j;
+        }
+    }
+    vs->table[i] = NULL;
+
+    for (size_t k = 0; k < vs->count; k++) {
+        if (vs->list[k] == v) {
+            memmove(&vs->list[k], &vs->list[k + 1], (vs->count - k - 1) * sizeof(var *));
+            break;
+        }
+    }
+    vs->count--;
+    free(v->entry);
+    free(v);
+    vs->envp_dirty = 1;
+}
+
+// The environment for the next child: exported variables, in order. The
+// array and its strings belong to the store and stay valid until the next
+// vars_set() or vars_unset(). NULL if out of memory.
+char **vars_envp(void) {
+    vars_store *vs = shell->vars;
+    if (!vs->envp_dirty && vs->envp_cache) return vs->envp_cache;
+
+    char **envp = realloc(vs->envp_cache, (vs->count + 1) * sizeof(char *));
+    if (!envp) return NULL;
+    size_t n = 0;
+    for (size_t k = 0; k < vs->count; k++) {
+        if (vs->list[k]->exported) envp[n++] = vs->list[k]->entry;
+    }
+    envp[n] = NULL;
+    vs->envp_cache = envp;
+    vs->envp_dirty = 0;
+    return envp;
+}
+
+void vars_print_exported(void) {
+    vars_store *vs = shell->vars;
+    for (size_t k = 0; k < vs->count; k++) {
+        if (vs->list[k]->exported) fprintf(shell->out, "%s\n", vs->list[k]->entry);
+    }
+}
+
+void vars_store_free(vars_store *vs) {
+    if (!vs) return;
+    for (size_t k = 0; k < vs->count; k++) {
+        free(vs->list[k]->entry);
+        free(vs->list[k]);
+    }
+    free(vs->list);
+    free(vs->table);
+    free(vs->envp_cache);
+    free(vs);
+}
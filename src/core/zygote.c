@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include "../include/zygote.h"
+#include "../include/shell.h"
+#include "../include/errors.h"
+#include "../include/stats.h"
+#include "../include/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+// stdin, stdout, stderr and the working directory of the command
+#define ZYGOTE_FDS 4
+
+// Sent with the fds; followed by `len` bytes of NUL-terminated strings: the
+// path, then argc arguments, then envc environment entries
+typedef struct zygote_request {
+    uint32_t len;
+    uint32_t argc;
+    uint32_t envc;
+    int32_t pgid;
+    uint32_t foreground;
+} zygote_request;
+
+static int zygote_fd = -1;
+
+// The header and its fds, in one recvmsg
+static int recv_request(int sock, zygote_request *req, int *fds) {
+    char control[CMSG_SPACE(ZYGOTE_FDS * sizeof(int))];
+    struct iovec iov = {req, sizeof(*req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)sizeof(*req)) return -1;
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (!c || c->cmsg_type != SCM_RIGHTS ||
+        c->cmsg_len != CMSG_LEN(ZYGOTE_FDS * sizeof(int))) {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(c), ZYGOTE_FDS * sizeof(int));
+    return 0;
+}
+
+// Runs in the helper, which from here on never touches the shell's state.
+// The helper's stdin is the shell's terminal.
+static void zygote_exec(const zygote_request *req, const int *fds, char **strings) {
+    signal(SIGINT, SIG_DFL);
+    if (req->pgid >= 0) setpgid(0, req->pgid);
+    if (req->foreground) {
+        signal(SIGTTOU, SIG_IGN);
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+        signal(SIGTTOU, SIG_DFL);
+    }
+    if (fchdir(fds[3]) < 0) _exit(1);
+    for (int i = 0; i < 3; i++) {
+        if (dup2(fds[i], i) < 0) _exit(1);
+    }
+    execve(strings[0], strings + 1, strings + req->argc + 2);
+    print_error();
+    _exit(126);
+}
+
+static void zygote_main(int sock) {
+    // Ctrl-C is for the commands, not the helper
+    signal(SIGINT, SIG_IGN);
+
+    zygote_request req;
+    int fds[ZYGOTE_FDS];
+    while (recv_request(sock, &req, fds) == 0) {
+        char *blob = malloc(req.len);
+        char **strings = malloc((req.argc + req.envc + 3) * sizeof(char *));
+        if (!blob || !strings || read_full(sock, blob, req.len) < 0) _exit(0);
+
+        // path, argv..., NULL, envp..., NULL
+        char *p = blob;
+        int k = 0;
+        strings[k++] = p;
+        p += strlen(p) + 1;
+        for (uint32_t i = 0; i < req.argc; i++, p += strlen(p) + 1) strings[k++] = p;
+        strings[k++] = NULL;
+        for (uint32_t i = 0; i < req.envc; i++, p += strlen(p) + 1) strings[k++] = p;
+        strings[k++] = NULL;
+
+        // Started as a sibling of the helper: the shell's child
+        pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL);
+        if (pid == 0) zygote_exec(&req, fds, strings);
+        int32_t reply = pid < 0 ? -errno : pid;
+
+        for (int i = 0; i < ZYGOTE_FDS; i++) close(fds[i]);
+        free(blob);
+        free(strings);
+        if (send_full(sock, &reply, sizeof(reply)) < 0) break;
+    }
+    _exit(0);
+}
+
+// Start the helper. Must run before the shell blocks signals, so the
+// commands it starts inherit the original signal mask.
+int zygote_start(void) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return -1;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        zygote_main(sv[1]);
+    }
+    close(sv[1]);
+    zygote_fd = sv[0];
+    return 0;
+}
+
+int zygote_available(void) {
+    return zygote_fd >= 0;
+}
+
+static void zygote_close(void) {
+    close(zygote_fd);
+    zygote_fd = -1;
+}
+
+static size_t strings_size(char **strings, uint32_t *count) {
+    size_t len = 0;
+    *count = 0;
+    for (; strings[*count]; (*count)++) len += strlen(strings[*count]) + 1;
+    return len;
+}
+
+static char *append_strings(char *p, char **strings, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        size_t n = strlen(strings[i]) + 1;
+        memcpy(p, strings[i], n);
+        p += n;
+    }
+    return p;
+}
+
+// Have the helper start a command. An fd of -1 stands for the shell's own
+// stdin, stdout or stderr. Returns the pid, which the shell reaps as its own
+// child, or -1. If the helper has gone away it is dropped, and
+// zygote_available() says so from then on.
+pid_t zygote_launch(const char *path, char **args, char **envp, int in_fd,
+                    int out_fd, int err_fd, pid_t pgid, int foreground) {
+    zygote_request req;
+    req.pgid = pgid;
+    req.foreground = foreground;
+    size_t path_len = strlen(path) + 1;
+    size_t len = path_len + strings_size(args, &req.argc) + strings_size(envp, &req.envc);
+    if (len > UINT32_MAX) return -1;
+    req.len = (uint32_t)len;
+
+    char *blob = malloc(len);
+    if (!blob) return -1;
+    memcpy(blob, path, path_len);
+    append_strings(append_strings(blob + path_len, args, req.argc), envp, req.envc);
+
+    int fds[ZYGOTE_FDS];
+    fds[0] = in_fd >= 0 ? in_fd : STDIN_FILENO;
+    fds[1] = out_fd >= 0 ? out_fd : STDOUT_FILENO;
+    fds[2] = err_fd >= 0 ? err_fd : STDERR_FILENO;
+    // The context's working directory, which is the process's only for the
+    // shell's own context
+    fds[3] = shell->cwd_fd == AT_FDCWD ? open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)
+                                       : fcntl(shell->cwd_fd, F_DUPFD_CLOEXEC, 0);
+    if (fds[3] < 0) {
+        free(blob);
+        return -1;
+    }
+
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    close(fds[3]);
+
+    int32_t reply;
+    int ok = sent == (ssize_t)sizeof(req) &&
+             send_full(zygote_fd, blob, len) == 0 &&
+             read_full(zygote_fd, &reply, sizeof(reply)) == 0;
+    free(blob);
+    if (!ok) {
+        zygote_close();
+        return -1;
+    }
+    if (reply < 0) {
+        errno = -reply;
+        return -1;
+    }
+    stats.zygote_launches++;
+    return reply;
+}
+
+// A forked copy of the shell must not share the parent's connection, and
+// the helper's commands would not be its children anyway
+void zygote_child_reset(void) {
+    if (zygote_fd >= 0) zygote_close();
+}
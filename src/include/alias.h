@@ -0,0 +1,27 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include "shell.h"
+
+// An alias body is parsed once, the first time the alias runs, and kept as
+// a template until the alias is redefined. `active` is set while the alias
+// runs, so an alias that uses its own name reaches the real command.
+typedef struct alias {
+    char *name;
+    char *value;
+    command_list *body;
+    int body_error;
+    int active;
+    struct alias *next; // definition order, newest first
+} alias;
+
+alias_store *alias_store_new(void);
+void alias_store_free(alias_store *as);
+alias *find_alias(const char *name);
+int alias_set(const char *name, const char *value);
+void alias_print(const alias *a);
+void alias_print_all(void);
+command_list *alias_expand(alias *a, char **args);
+void free_aliases(void);
+
+#endif
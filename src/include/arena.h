@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump-pointer allocator. Everything allocated from an arena is released
+// together by arena_reset() or arena_destroy(); there is no per-object free.
+typedef struct arena arena;
+
+arena *arena_create(void);
+void *arena_alloc(arena *a, size_t size);
+void *arena_calloc(arena *a, size_t count, size_t size);
+char *arena_strdup(arena *a, const char *str);
+char *arena_strndup(arena *a, const char *str, size_t len);
+void arena_reset(arena *a);
+void arena_destroy(arena *a);
+
+// Pooled arenas: release resets the arena and keeps it for the next acquire.
+// Each shell context has its own pool.
+typedef struct arena_pool arena_pool;
+
+arena_pool *arena_pool_new(void);
+void arena_pool_free(arena_pool *pool);
+arena *arena_acquire(void);
+void arena_release(arena *a);
+
+#endif
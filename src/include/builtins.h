@@ -0,0 +1,27 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+// Builtin flags
+#define BUILTIN_PARENT 0x1 // changes shell state; only takes effect in the shell itself
+#define BUILTIN_NO_MAN 0x2 // has no manual page
+
+typedef struct builtin {
+    const char *name;
+    int (*handler)(char **args);
+    int flags;
+} builtin;
+
+const builtin *find_builtin(const char *name);
+
+// Seeded FNV-1a. The build searches for a seed under which every builtin
+// name lands in its own slot, so a lookup is one hash and one compare.
+static inline unsigned int builtin_name_hash(const char *name, unsigned int seed) {
+    unsigned int h = seed;
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+#endif
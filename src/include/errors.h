@@ -2,5 +2,6 @@
 #define ERRORS_H
 
 void print_error(void);
+void print_error_fd(int fd);
 
 #endif
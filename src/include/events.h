@@ -0,0 +1,18 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <signal.h>
+
+#define EVENT_INPUT     0x1
+#define EVENT_CHILD     0x2
+#define EVENT_INTERRUPT 0x4
+
+// The shell keeps SIGCHLD and SIGINT blocked for its whole life and takes
+// them from signalfds through a single epoll instance instead, so waiting
+// for children costs no per-command signal mask changes.
+int events_init(int catch_interrupts);
+void events_child_reset(void);
+const sigset_t *events_child_mask(void);
+int events_wait(int fd, int timeout_ms);
+
+#endif
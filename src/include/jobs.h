@@ -0,0 +1,84 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "shell.h"
+#include "launch.h"
+#include "trace.h"
+#include <termios.h>
+#include <sys/resource.h>
+
+typedef enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} job_state;
+
+// One '&' unit of work: a command or pipeline whose words were expanded when
+// it was submitted, in sequence. Jobs wait in a ready queue until one of the
+// concurrency limit's slots is free. Normally all of a job's memory belongs
+// to the line that submitted it, which waits for its group before releasing
+// it. Under job control (interactive mode) jobs outlive their line instead:
+// such a job is in group 0, keeps everything it needs in `mem`, and stays
+// in the table until its end has been reported.
+typedef struct job {
+    int id;
+    int group;
+    job_state state;
+    arena *mem;            // owned by a job in group 0
+    command *cmds;
+    char ***argv;
+    int nstages;
+    pid_t *pids;
+    int *statuses;
+    int live;
+    pid_t pgid;            // process group, under job control
+    int signo;             // that stopped the job or ended its last stage
+    int notified;          // the current state has been reported
+    struct termios tmodes; // terminal settings when the job stopped
+    time_format timed;     // from a `time` prefix, reported when the job ends
+    uint64_t start_ns;
+    struct rusage usage;   // of the job's processes
+    trace_context trace;   // the line that submitted it
+} job;
+
+job_table *job_table_new(void);
+void job_table_free(job_table *t);
+int jobs_get_limit(void);
+void jobs_set_limit(int limit);
+int jobs_new_group(void);
+int jobs_submit(int group, command *cmds, char ***argv, int nstages, arena *mem);
+void jobs_wait_group(int group);
+void jobs_print(void);
+void jobs_child_reset(void);
+void jobs_reap(void);
+
+// Job control, for interactive mode: jobs outlive their line, and with a
+// terminal every job runs in its own process group
+void jobs_control_init(void);
+int jobs_detached(void);
+int jobs_terminal(void);
+int jobs_stopped(char ***argv, int nstages, pid_t *pids, int *statuses, int wstatus);
+void jobs_take_terminal(void);
+void jobs_notify(void);
+
+// For the wait, fg, bg and kill builtins. A job spec is %N, %% or %+ (the
+// current job), or with `bare_ids` also N.
+job *jobs_find(const char *spec, int bare_ids);
+job *jobs_find_pid(pid_t pid);
+job *jobs_current(int stopped_only);
+int jobs_wait(job *j);
+int jobs_wait_all(void);
+int jobs_foreground(job *j);
+int jobs_background(job *j);
+int jobs_signal(job *j, int sig);
+
+pid_t wait_child(pid_t pid, int *status);
+pid_t wait_any_child(const pid_t *pids, int count, int *status);
+
+// Provided by the executor: start every stage of a pipeline, wired with
+// pipes, without waiting. Returns the number of stages running.
+int start_pipeline(command *cmds, char ***argv, int nstages, pid_t *pids, int *statuses,
+                   int foreground);
+
+#endif
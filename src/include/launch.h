@@ -0,0 +1,35 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include "shell.h"
+
+// How external commands are started. posix_spawn (clone with CLONE_VFORK
+// under glibc) does not copy the shell's page tables; fork is kept for
+// comparison and can be selected with OSHELL_LAUNCH=fork. OSHELL_LAUNCH=zygote
+// hands launches to a helper forked at startup (see zygote.h).
+typedef enum {
+    LAUNCH_SPAWN,
+    LAUNCH_FORK,
+    LAUNCH_ZYGOTE
+} launch_backend;
+
+// Under job control each job is a process group of its own, which the
+// command joins before it execs: pgid 0 makes it the leader of a new group.
+// A foreground group is also handed the terminal (see jobs_terminal()).
+typedef struct process_group {
+    pid_t pgid;
+    int foreground;
+} process_group;
+
+command_hash *command_hash_new(void);
+void command_hash_free(command_hash *h);
+const char *find_in_path(const char *cmd);
+void command_hash_clear(void);
+void command_hash_chdir(void);
+void command_hash_print(void);
+launch_backend launch_get_backend(void);
+void launch_set_backend(launch_backend b);
+int launch_command(const command *cmd, char **args, int in_fd, int out_fd,
+                   const process_group *group, pid_t *pid);
+
+#endif
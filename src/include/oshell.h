@@ -0,0 +1,66 @@
+#ifndef OSHELL_H
+#define OSHELL_H
+
+#include <stddef.h>
+
+// liboshell: the shell as a library. Every context is a shell of its own,
+// with its own search path, working directory, variables, aliases, command
+// hash, background jobs, stdio and $?. What the core keeps outside a
+// context (parse cache, readahead, launch backend, signal mask, tracing
+// buffers) is kept per thread, so threads may run different contexts at
+// the same time; a single context must only be used by one thread at a
+// time. All contexts share the process's signal dispositions and the trace
+// file, to which each thread appends whole records.
+//
+// A line is parsed once into a script, which belongs to no context, holds
+// words unexpanded and is never changed by running it: it can be run any
+// number of times, by any context, from any thread.
+//
+// The library installs no signal handlers and waits for its children by
+// pid only. The host must not ignore SIGCHLD or reap children it did not
+// start itself. Builtins and aliases that are pipeline stages run in a fork
+// of the calling process, as in the shell.
+
+#define OSHELL_API __attribute__((visibility("default")))
+
+typedef struct oshell_ctx oshell_ctx;
+typedef struct command_list oshell_script;
+
+// A new context with path /bin, the process's working directory and stdio,
+// and `envp` (NULL: the process's environment) as its exported variables.
+// Returns NULL if out of memory.
+OSHELL_API oshell_ctx *oshell_ctx_new(char *const *envp);
+OSHELL_API void oshell_ctx_free(oshell_ctx *ctx);
+
+// Run the context's commands on copies of these descriptors; -1 keeps the
+// current one
+OSHELL_API int oshell_ctx_set_stdio(oshell_ctx *ctx, int in_fd, int out_fd, int err_fd);
+
+// Replace the search path with the NULL-terminated `dirs`, as `path` does
+OSHELL_API int oshell_ctx_set_path(oshell_ctx *ctx, const char *const *dirs);
+
+OSHELL_API int oshell_ctx_setvar(oshell_ctx *ctx, const char *name, const char *value);
+
+// The value stays valid until the variable is next set or unset
+OSHELL_API const char *oshell_ctx_getvar(oshell_ctx *ctx, const char *name);
+
+OSHELL_API int oshell_ctx_alias(oshell_ctx *ctx, const char *name, const char *value);
+
+// $? of the context, and whether `exit` has run in it. A context that has
+// exited runs nothing more.
+OSHELL_API int oshell_ctx_status(const oshell_ctx *ctx);
+OSHELL_API int oshell_ctx_exited(const oshell_ctx *ctx);
+
+// Parse a line. Returns NULL for a blank line, and NULL with *error set for
+// a syntax error.
+OSHELL_API oshell_script *oshell_parse(const char *line, size_t len, int *error);
+OSHELL_API void oshell_script_free(oshell_script *script);
+
+// Run a parsed line in `ctx` and return its exit status
+OSHELL_API int oshell_ctx_exec(oshell_ctx *ctx, const oshell_script *script);
+
+// Parse and run one line; a syntax error is reported on the context's
+// stderr and returns 1
+OSHELL_API int oshell_ctx_run(oshell_ctx *ctx, const char *line);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef OSHELL_CLIENT_H
+#define OSHELL_CLIENT_H
+
+#include <stddef.h>
+
+// Client side of `oshell --serve SOCKET`. A session is one connection to the
+// server; its lines share a working directory, variables, aliases and $?,
+// which no other session sees.
+typedef struct oshell_session oshell_session;
+
+// Receives captured output: stream is 1 for stdout, 2 for stderr
+typedef void (*oshell_output_fn)(int stream, const char *data, size_t len, void *arg);
+
+oshell_session *oshell_connect(const char *path);
+
+// Run one command line and return its exit status (0-255), or -1 if the
+// session is over. With `output` NULL the line runs on the caller's stdin,
+// stdout and stderr; otherwise its output is captured and passed to
+// `output`, and its stdin is /dev/null.
+int oshell_run(oshell_session *s, const char *line, oshell_output_fn output, void *arg);
+
+void oshell_close(oshell_session *s);
+
+// A replacement for system(): runs `command` in a fresh session on the
+// caller's stdio. Returns its exit status, or -1 if the server could not
+// be reached.
+int oshell_system(const char *path, const char *command);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include "shell.h"
+#include "utils.h"
+#include "trace.h"
+
+#define READAHEAD_DEPTH 128
+
+typedef enum {
+    READAHEAD_EOF,
+    READAHEAD_LINE,
+    READAHEAD_ERROR
+} readahead_status;
+
+typedef struct readahead_entry {
+    command_list *cmds;
+    int error;
+    trace_context ctx;
+} readahead_entry;
+
+// Bounded queue of lines parsed ahead of execution. Lines are lexed while
+// earlier commands' children run; expansion still happens when each line is
+// executed, so $? and the environment are seen in order.
+typedef struct readahead {
+    line_reader *reader;
+    readahead_entry slots[READAHEAD_DEPTH];
+    int head;
+    int count;
+    int eof;
+    long lineno;           // lines read so far
+    trace_context current; // where the line last returned came from
+} readahead;
+
+void readahead_start(readahead *ra, line_reader *reader);
+readahead_status readahead_next(readahead *ra, command_list **cmds);
+void readahead_stop(readahead *ra);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+// Character classes the tokenizer cares about. scan_line() records each one
+// as a bitmask over the line: bit (i % 64) of word (i / 64) is set when byte
+// i belongs to the class.
+typedef enum {
+    CLS_SPACE,      // isspace()
+    CLS_OP,         // ; & | < >
+    CLS_QUOTE,      // ' "
+    CLS_HASH,       // #
+    CLS_DOLLAR,     // $
+    CLS_BREAK,      // SPACE | OP | QUOTE: ends an unquoted word
+    CLS_COUNT
+} char_class;
+
+typedef struct line_scan {
+    size_t len;
+    uint64_t *mask[CLS_COUNT];
+} line_scan;
+
+static inline int scan_test(const line_scan *ls, char_class cls, size_t i) {
+    return (ls->mask[cls][i / 64] >> (i % 64)) & 1;
+}
+
+int scan_line(arena *mem, const char *line, size_t len, line_scan *ls);
+size_t scan_next(const line_scan *ls, char_class cls, size_t from, size_t to);
+size_t scan_next_clear(const line_scan *ls, char_class cls, size_t from, size_t to);
+size_t scan_rtrim(const line_scan *ls, char_class cls, size_t from, size_t to);
+size_t scan_count(const line_scan *ls, char_class cls, size_t from, size_t to);
+
+#endif
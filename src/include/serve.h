@@ -0,0 +1,35 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+
+// Wire format of a --serve connection, shared with the client library. A
+// connection is one session. For each command line the client sends a
+// serve_request followed by `len` bytes of the line; without SERVE_CAPTURE
+// the request carries the client's stdin, stdout and stderr as SCM_RIGHTS
+// fds, and the line runs on them. The server answers with any number of
+// SERVE_STDOUT / SERVE_STDERR frames of captured output, then one
+// SERVE_STATUS frame with a 4-byte exit status. Integers are host order:
+// both ends are on the same machine.
+#define SERVE_CAPTURE 0x1
+
+#define SERVE_MAX_LINE (1u << 20)
+#define SERVE_CHUNK 65536
+
+typedef struct serve_request {
+    uint32_t flags;
+    uint32_t len;
+} serve_request;
+
+typedef enum {
+    SERVE_STDOUT = 1,
+    SERVE_STDERR = 2,
+    SERVE_STATUS = 3
+} serve_frame_type;
+
+typedef struct serve_frame {
+    uint32_t type;
+    uint32_t len;
+} serve_frame;
+
+#endif
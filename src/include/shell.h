@@ -2,11 +2,14 @@
 #define SHELL_H
 
 #include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
 
 typedef enum {
     MODE_INTERACTIVE,
     MODE_PIPE,
     MODE_BATCH,
+    MODE_SERVE,
     MODE_INVALID
 } shell_mode;
 
@@ -20,35 +23,107 @@ typedef enum {
     OP_SEQ,
     OP_AND,
     OP_OR,
-    OP_BG
+    OP_BG,
+    OP_PIPE
 } op_type;
 
+// Output of a `time` prefix
+typedef enum {
+    TIME_OFF,
+    TIME_TEXT,
+    TIME_JSON
+} time_format;
+
+// A word is kept unexpanded in the parsed line: a run of literal text and
+// variable references that expand_command() resolves at execution time.
+typedef enum {
+    SEG_LITERAL,
+    SEG_VAR,
+    SEG_STATUS,
+    SEG_PID
+} seg_type;
+
+typedef struct word_seg {
+    seg_type type;
+    const char *text;
+    size_t len;
+} word_seg;
+
+typedef struct word {
+    word_seg *segs;
+    int nsegs;
+} word;
+
 typedef struct command {
-    char **args;
+    word *words;
+    int argc;
     redir_type redir_type;
     char *redir_file;
     op_type next_op;
+    time_format timed; // set on the first command of a timed pipeline
 } command;
 
-typedef struct {
+typedef struct arena arena;
+
+// One parsed line. Every command, word and string hangs off `mem`, so the
+// whole line is released at once when the last reference is dropped by
+// free_commands(). Lines from parse_line_cached() hold an extra reference
+// owned by the cache.
+typedef struct command_list {
+    command *cmds;
+    int count;
+    int refs;
+    arena *mem;
+    uint64_t parse_ns;
+} command_list;
+
+typedef struct vars_store vars_store;
+typedef struct alias_store alias_store;
+typedef struct command_hash command_hash;
+typedef struct job_table job_table;
+typedef struct arena_pool arena_pool;
+
+// Everything one shell owns. The oshell program runs a single context, the
+// process's own; liboshell callers create as many as they like (see
+// oshell.h). Code works on `shell`, the context the calling thread runs.
+typedef struct oshell_ctx {
     char **path_list;
     int path_count;
     char *pwd;
     char *oldpwd;
+    int cwd_fd;       // AT_FDCWD: the process's working directory
     int exit_status;
+    int exited;       // `exit` ran in a context that cannot exit the process
     pid_t shell_pid;
+    int fds[3];       // stdin, stdout and stderr of what the shell runs
+    FILE *out;        // builtin output, on fds[1]
+    FILE *err;        // error messages, on fds[2]
+    char *scratch;    // expansion buffer
+    size_t scratch_cap;
+    vars_store *vars;
+    alias_store *aliases;
+    command_hash *hash;
+    job_table *jobs;
+    arena_pool *arenas;
 } shell_state;
 
-extern shell_state g_state;
+extern shell_state shell_process;
+extern _Thread_local shell_state *shell;
 
 // Function prototypes
-command *parse_line(char *line);
-int execute_sequence(command *cmds);
+command_list *parse_line(const char *line, size_t len);
+command_list *parse_commands(const char *line, size_t len, int *error);
+command_list *parse_line_cached(const char *line, size_t len, int *error);
+int execute_sequence(command_list *list);
 int execute_builtin(char **args);
+int is_builtin(const char *name);
 void init_shell_state(void);
 void free_shell_state(void);
-void free_commands(command *cmds);
-char *expand_variables(char *str);
-char *expand_alias(const char *name);
+int shell_ctx_init(shell_state *ctx, char **envp);
+void shell_ctx_free(shell_state *ctx);
+void shell_use_stdio(void);
+void free_commands(command_list *list);
+void set_wait_hook(int (*hook)(void));
+char **expand_command(arena *mem, const command *cmd);
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+// Counters the shell keeps as it runs, shown by the `stats` builtin and, when
+// OSHELL_STATS is set, on stderr at exit. Each is a plain increment at the
+// point the event happens; every thread counts for itself.
+#define STATS_COUNTERS(X)                                                    \
+    X(lines_read, "lines read")                                              \
+    X(bytes_parsed, "bytes parsed")                                          \
+    X(parse_cache_hits, "parse cache hits")                                  \
+    X(commands, "commands executed")                                         \
+    X(spawns, "posix_spawn calls")                                           \
+    X(forks, "forks")                                                        \
+    X(zygote_launches, "zygote launches")                                    \
+    X(builtins, "builtins run in-process")                                   \
+    X(path_lookups, "path lookups")                                          \
+    X(path_hits, "path cache hits")                                          \
+    X(alias_expansions, "alias expansions")                                  \
+    X(allocations, "arena allocations")                                      \
+    X(alloc_bytes, "arena bytes allocated")                                  \
+    X(peak_jobs, "peak background jobs")
+
+typedef struct shell_stats {
+#define X(field, label) unsigned long field;
+    STATS_COUNTERS(X)
+#undef X
+} shell_stats;
+
+extern _Thread_local shell_stats stats;
+
+void stats_print(FILE *out);
+void stats_reset(void);
+void stats_init(void);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "shell.h"
+#include <sys/resource.h>
+
+// Work the shell itself does around each command
+typedef enum {
+    PHASE_PARSE,
+    PHASE_EXPAND,
+    PHASE_LOOKUP,
+    PHASE_LAUNCH,
+    PHASE_COUNT
+} shell_phase;
+
+// One `time` in progress. Reports nest: children reaped and shell phases
+// measured while a report is open are added to every open report.
+typedef struct time_report {
+    uint64_t start_ns;
+    uint64_t phase_ns[PHASE_COUNT];
+    struct rusage self;     // the shell's own usage when the report opened
+    struct rusage children; // usage of children reaped since
+    struct time_report *outer;
+} time_report;
+
+extern _Thread_local time_report *open_reports;
+
+uint64_t timing_now(void);
+
+// Phase measurement costs nothing unless a report is open
+static inline uint64_t phase_start(void) {
+    return open_reports ? timing_now() : 0;
+}
+void phase_end(shell_phase phase, uint64_t start);
+
+void rusage_add(struct rusage *sum, const struct rusage *ru);
+void timing_child_reaped(const struct rusage *ru);
+void timing_begin(time_report *r);
+void timing_end(time_report *r, uint64_t parse_ns, time_format format);
+void timing_print(time_format format, uint64_t real_ns, const struct rusage *usage,
+                  const uint64_t *phase_ns);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "shell.h"
+
+// Execution trace: one JSON line per executed command, with monotonic
+// timestamps (ns) for each step the shell takes on its behalf. Enabled by
+// --trace=FILE or OSHELL_TRACE=FILE, for the thread that opens the trace and
+// the copies of the shell it forks.
+typedef enum {
+    TRACE_READ,   // line read from the input
+    TRACE_PARSE,  // line parsed
+    TRACE_EXPAND, // words expanded
+    TRACE_LOOKUP, // path resolved
+    TRACE_SPAWN,  // launch started
+    TRACE_EXEC,   // launch returned; with posix_spawn the child has exec'd
+    TRACE_REAP,   // exit collected
+    TRACE_POINTS
+} trace_point;
+
+// Where the command being run came from
+typedef struct trace_context {
+    long lineno;
+    uint64_t read_ns;
+    uint64_t parse_ns;
+    uint64_t expand_ns;
+} trace_context;
+
+extern _Thread_local int tracing;
+extern _Thread_local trace_context trace_current;
+
+int trace_open(const char *path);
+void trace_close(void);
+void trace_child_reset(void);
+void trace_launched(pid_t pid, const char *name, uint64_t lookup_ns,
+                    uint64_t spawn_ns, uint64_t exec_ns);
+void trace_reaped(pid_t pid, int status);
+void trace_finished(const char *name, int status, uint64_t start_ns);
+
+#endif
@@ -1,8 +1,36 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-#include <stdio.h>
+#include <stddef.h>
 
-char *read_line(FILE *stream);
+#define READER_BLOCK_SIZE (64 * 1024)
+
+// Line reader over a file descriptor, or over a read-only mapping of a
+// regular file. Lines are returned as (pointer, length) views into the
+// reader's buffer, are NOT NUL-terminated, and stay valid until the next
+// reader_next() call.
+typedef struct line_reader {
+    int fd;
+    int owns_fd;
+    int mapped;
+    char *buf;
+    size_t cap;
+    size_t start;   // first byte of the next line
+    size_t scanned; // bytes from start already known to hold no newline
+    size_t end;     // end of buffered data
+    int eof;
+    int (*wait_input)(int fd); // if set, called before each blocking read
+} line_reader;
+
+line_reader *reader_open(int fd);
+line_reader *reader_open_file(const char *path);
+char *reader_next(line_reader *r, size_t *len);
+int reader_ready(line_reader *r);
+void reader_close(line_reader *r);
+
+// Whole-buffer socket I/O, retried on EINTR and short transfers. send_full()
+// never raises SIGPIPE. Both return 0, or -1 on error or (read_full) EOF.
+int send_full(int sock, const void *buf, size_t len);
+int read_full(int fd, void *buf, size_t len);
 
 #endif
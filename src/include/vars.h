@@ -0,0 +1,26 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include "shell.h"
+#include <stddef.h>
+
+// Shell variables, owned by each shell context rather than libc's environ.
+// Each variable is stored as one "NAME=VALUE" string, so the environment
+// handed to children is just an array of pointers into the store; it is
+// built on demand and reused until a variable changes.
+typedef struct var {
+    char *entry;      // "NAME=VALUE"
+    size_t name_len;
+    int exported;
+} var;
+
+vars_store *vars_store_new(char **envp);
+void vars_store_free(vars_store *vs);
+const char *vars_get(const char *name);
+const char *vars_getn(const char *name, size_t len);
+int vars_set(const char *name, const char *value, int exported);
+void vars_unset(const char *name);
+char **vars_envp(void);
+void vars_print_exported(void);
+
+#endif
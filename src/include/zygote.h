@@ -0,0 +1,19 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <sys/types.h>
+
+// Launch helper forked at startup, while the shell is still small. It takes
+// launch requests over a socketpair (strings inline, stdio and cwd as fds
+// with SCM_RIGHTS) and starts each command with clone(CLONE_PARENT), so the
+// command is the shell's own child and is reaped like any other, but is
+// copied from the helper's address space instead of the shell's. `pgid`
+// and `foreground` are as in process_group; pgid -1 leaves the command in
+// the helper's group.
+int zygote_start(void);
+int zygote_available(void);
+pid_t zygote_launch(const char *path, char **args, char **envp, int in_fd,
+                    int out_fd, int err_fd, pid_t pgid, int foreground);
+void zygote_child_reset(void);
+
+#endif
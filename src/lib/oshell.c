@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include "../include/oshell.h"
+#include "../include/shell.h"
+#include "../include/alias.h"
+#include "../include/errors.h"
+#include "../include/launch.h"
+#include "../include/vars.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// The library side of a context: every call makes `ctx` the calling
+// thread's current shell for as long as it runs, so the core works on it
+// exactly as on the program's own.
+
+extern char **environ;
+
+static shell_state *enter(oshell_ctx *ctx) {
+    shell_state *outer = shell;
+    shell = ctx;
+    return outer;
+}
+
+static void leave(shell_state *outer) {
+    fflush(shell->out);
+    shell = outer;
+}
+
+oshell_ctx *oshell_ctx_new(char *const *envp) {
+    oshell_ctx *ctx = malloc(sizeof(*ctx));
+    if (!ctx) return NULL;
+    if (shell_ctx_init(ctx, (char **)(envp ? envp : environ)) < 0) {
+        shell_ctx_free(ctx);
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void oshell_ctx_free(oshell_ctx *ctx) {
+    if (!ctx) return;
+    shell_ctx_free(ctx);
+    free(ctx);
+}
+
+// Descriptors 0-2 stand for the process's own stdio, so copies are made
+// above them
+static int copy_fd(int fd, int current) {
+    if (fd < 0) return current;
+    return fcntl(fd, F_DUPFD_CLOEXEC, 3);
+}
+
+int oshell_ctx_set_stdio(oshell_ctx *ctx, int in_fd, int out_fd, int err_fd) {
+    int fds[3] = {copy_fd(in_fd, ctx->fds[0]), copy_fd(out_fd, ctx->fds[1]),
+                  copy_fd(err_fd, ctx->fds[2])};
+    FILE *out = out_fd < 0 ? ctx->out : fds[1] >= 0 ? fdopen(fds[1], "w") : NULL;
+    FILE *err = err_fd < 0 ? ctx->err : fds[2] >= 0 ? fdopen(fds[2], "w") : NULL;
+    if (fds[0] < 0 || !out || !err) {
+        if (in_fd >= 0 && fds[0] >= 0) close(fds[0]);
+        if (out_fd >= 0) {
+            if (out) fclose(out);
+            else if (fds[1] >= 0) close(fds[1]);
+        }
+        if (err_fd >= 0) {
+            if (err) fclose(err);
+            else if (fds[2] >= 0) close(fds[2]);
+        }
+        return -1;
+    }
+
+    if (in_fd >= 0 && ctx->fds[0] != STDIN_FILENO) close(ctx->fds[0]);
+    if (out_fd >= 0) {
+        fflush(ctx->out);
+        if (ctx->out != stdout) fclose(ctx->out);
+        ctx->out = out;
+    }
+    if (err_fd >= 0) {
+        if (ctx->err != stderr) fclose(ctx->err);
+        setvbuf(err, NULL, _IONBF, 0);
+        ctx->err = err;
+    }
+    memcpy(ctx->fds, fds, sizeof(fds));
+    return 0;
+}
+
+int oshell_ctx_set_path(oshell_ctx *ctx, const char *const *dirs) {
+    int count = 0;
+    while (dirs && dirs[count]) count++;
+
+    char **list = malloc((count + 1) * sizeof(char *));
+    if (!list) return -1;
+    for (int i = 0; i < count; i++) {
+        list[i] = strdup(dirs[i]);
+        if (!list[i]) {
+            while (i-- > 0) free(list[i]);
+            free(list);
+            return -1;
+        }
+    }
+    list[count] = NULL;
+
+    for (int i = 0; i < ctx->path_count; i++) {
+        free(ctx->path_list[i]);
+    }
+    free(ctx->path_list);
+    ctx->path_list = list;
+    ctx->path_count = count;
+
+    // Resolved paths may no longer be what a search would find
+    shell_state *outer = enter(ctx);
+    command_hash_clear();
+    leave(outer);
+    return 0;
+}
+
+int oshell_ctx_setvar(oshell_ctx *ctx, const char *name, const char *value) {
+    shell_state *outer = enter(ctx);
+    int status = vars_set(name, value, 1);
+    leave(outer);
+    return status;
+}
+
+const char *oshell_ctx_getvar(oshell_ctx *ctx, const char *name) {
+    shell_state *outer = enter(ctx);
+    const char *value = vars_get(name);
+    leave(outer);
+    return value;
+}
+
+int oshell_ctx_alias(oshell_ctx *ctx, const char *name, const char *value) {
+    shell_state *outer = enter(ctx);
+    int status = alias_set(name, value);
+    leave(outer);
+    return status;
+}
+
+int oshell_ctx_status(const oshell_ctx *ctx) {
+    return ctx->exit_status;
+}
+
+int oshell_ctx_exited(const oshell_ctx *ctx) {
+    return ctx->exited;
+}
+
+// Scripts belong to no context: their arenas are allocated and freed
+// outright, never taken from or given back to anyone's pool
+static shell_state *enter_unpooled(void) {
+    static _Thread_local shell_state none;
+    none.cwd_fd = AT_FDCWD;
+    none.out = stdout;
+    none.err = stderr;
+    return enter(&none);
+}
+
+oshell_script *oshell_parse(const char *line, size_t len, int *error) {
+    *error = 0;
+    shell_state *outer = enter_unpooled();
+    command_list *cmds = parse_commands(line, len, error);
+    shell = outer;
+    return cmds;
+}
+
+void oshell_script_free(oshell_script *script) {
+    shell_state *outer = enter_unpooled();
+    free_commands(script);
+    shell = outer;
+}
+
+int oshell_ctx_exec(oshell_ctx *ctx, const oshell_script *script) {
+    if (ctx->exited) return ctx->exit_status;
+    shell_state *outer = enter(ctx);
+    // Running a line reads it but never changes it
+    int status = execute_sequence((command_list *)script);
+    leave(outer);
+    return status;
+}
+
+int oshell_ctx_run(oshell_ctx *ctx, const char *line) {
+    if (ctx->exited) return ctx->exit_status;
+    shell_state *outer = enter(ctx);
+    // Parsed in the context, so the line's arena comes from its pool
+    int error = 0;
+    command_list *cmds = parse_commands(line, strlen(line), &error);
+    int status = 1;
+    if (error) {
+        print_error();
+    } else {
+        status = execute_sequence(cmds);
+    }
+    free_commands(cmds);
+    leave(outer);
+    return status;
+}
@@ -4,6 +4,15 @@
 int main(int argc, char **argv) {
     init_shell_state();
 
+    int nopts = parse_options(argc, argv);
+    if (nopts < 0) {
+        free_shell_state();
+        return 1;
+    }
+    argv[nopts] = argv[0];
+    argc -= nopts;
+    argv += nopts;
+
     shell_mode mode = determine_mode(argc, argv);
 
     switch (mode) {
@@ -16,6 +25,9 @@ int main(int argc, char **argv) {
         case MODE_BATCH:
             batch_mode(argv[1]);
             break;
+        case MODE_SERVE:
+            serve_mode(serve_path, worker_count);
+            break;
         case MODE_INVALID:
         default:
             free_shell_state();
@@ -1,25 +1,40 @@
 #include "modes.h"
 #include "../include/errors.h"
+#include "../include/readahead.h"
 #include "../include/utils.h"
 #include "../include/shell.h"
 #include <stdio.h>
 #include <stdlib.h>
 
 void batch_mode(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
+    line_reader *reader = reader_open_file(filename);
+    if (!reader) {
         print_error();
         exit(1);
     }
     
-    char *line;
-    while ((line = read_line(file)) != NULL) {
-        command *cmds = parse_line(line);
-        if (cmds) {
-            execute_sequence(cmds);
-            free_commands(cmds);
+    readahead ra;
+    readahead_start(&ra, reader);
+    
+    if (worker_count > 1) {
+        batch_parallel(&ra, worker_count);
+        readahead_stop(&ra);
+        reader_close(reader);
+        exit(0);
+    }
+    
+    command_list *cmds;
+    readahead_status status;
+    while ((status = readahead_next(&ra, &cmds)) != READAHEAD_EOF) {
+        if (status == READAHEAD_ERROR) {
+            print_error();
+            continue;
         }
+        trace_current = ra.current;
+        execute_sequence(cmds);
+        free_commands(cmds);
     }
-    fclose(file);
+    readahead_stop(&ra);
+    reader_close(reader);
     exit(0);
 }
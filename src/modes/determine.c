@@ -1,11 +1,72 @@
-#include "../include/shell.h"
+#include "modes.h"
 #include "../include/errors.h"
+#include "../include/trace.h"
+#include "../include/vars.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <unistd.h>
 
+int worker_count = 0;
+const char *serve_path = NULL;
+
+// The N of -j N or -jN, or -1
+static int parse_workers(const char *value) {
+    if (value == NULL) return -1;
+    char *endptr;
+    long n = strtol(value, &endptr, 10);
+    if (*endptr != '\0' || endptr == value || n < 1 || n > INT_MAX) return -1;
+    return (int)n;
+}
+
+// Handle the options in front of the script name, then OSHELL_TRACE if
+// --trace was not given. Returns how many arguments were options, or -1
+// after reporting a bad one.
+int parse_options(int argc, char **argv) {
+    const char *trace_path = NULL;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        int ok = 1;
+        if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8] != '\0') {
+            trace_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strncmp(argv[i], "--serve=", 8) == 0 && argv[i][8] != '\0') {
+            serve_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            worker_count = parse_workers(i + 1 < argc ? argv[++i] : NULL);
+            ok = worker_count > 0;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            worker_count = parse_workers(argv[i] + 2);
+            ok = worker_count > 0;
+        } else {
+            ok = 0;
+        }
+        if (!ok) {
+            print_error();
+            return -1;
+        }
+    }
+
+    if (!trace_path) trace_path = vars_get("OSHELL_TRACE");
+    if (trace_path && *trace_path && trace_open(trace_path) < 0) {
+        print_error();
+        return -1;
+    }
+    return i - 1;
+}
+
 shell_mode determine_mode(int argc, char **argv) {
     (void)argv;
 
-    if (argc > 2) {
+    if (serve_path) {
+        if (argc == 1) return MODE_SERVE;
+        print_error();
+        return MODE_INVALID;
+    }
+
+    // Otherwise -j only applies to a script
+    if (argc > 2 || (worker_count > 0 && argc != 2)) {
         print_error();
         return MODE_INVALID;
     } else if (argc == 2) {
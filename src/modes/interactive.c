@@ -1,36 +1,54 @@
 #include "modes.h"
 #include "../include/utils.h"
 #include "../include/shell.h"
+#include "../include/events.h"
+#include "../include/jobs.h"
+#include "../include/trace.h"
+#include "../include/timing.h"
 #include <stdio.h>
 #include <string.h>
-#include <signal.h>
 #include <unistd.h>
 
-static void handle_sigint(int sig) {
-    (void)sig;
-    write(STDOUT_FILENO, "\n$ ", 3);
+// SIGINT reaches the shell through the event loop; at the prompt it just
+// starts a fresh one
+static int wait_for_input(int fd) {
+    while (1) {
+        int events = events_wait(fd, -1);
+        if (events < 0 || (events & EVENT_INPUT)) return 0;
+        if (events & EVENT_INTERRUPT) write(STDOUT_FILENO, "\n$ ", 3);
+        if (events & EVENT_CHILD) jobs_reap();
+    }
 }
 
 void interactive_mode(void) {
-    struct sigaction sa;
-    sa.sa_handler = handle_sigint;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGINT, &sa, NULL);
-    
+    line_reader *reader = reader_open(STDIN_FILENO);
+    if (!reader) return;
+    reader->wait_input = wait_for_input;
+
+    // Background jobs outlive their line, and with a terminal they can be
+    // stopped and moved between foreground and background
+    jobs_control_init();
+
     char *line;
+    size_t len;
+    long lineno = 0;
     while (1) {
+        jobs_notify();
         printf("$ ");
         fflush(stdout);
-        line = read_line(stdin);
+        line = reader_next(reader, &len);
         if (!line) {
             printf("\n");
             break;
         }
-        command *cmds = parse_line(line);
+        trace_current.lineno = ++lineno;
+        trace_current.read_ns = tracing ? timing_now() : 0;
+        command_list *cmds = parse_line(line, len);
         if (cmds) {
+            trace_current.parse_ns = tracing ? timing_now() : 0;
             execute_sequence(cmds);
             free_commands(cmds);
         }
     }
+    reader_close(reader);
 }
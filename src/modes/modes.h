@@ -3,9 +3,18 @@
 
 #include "../include/shell.h"
 
+// From -j N: lines run at once in batch mode, or sessions served at once
+// with --serve (0 if not given)
+extern int worker_count;
+extern const char *serve_path;
+
+int parse_options(int argc, char **argv);
 shell_mode determine_mode(int argc, char **argv);
 void interactive_mode(void);
 void pipe_mode(void);
 void batch_mode(const char *filename);
+struct readahead;
+void batch_parallel(struct readahead *ra, int workers);
+void serve_mode(const char *path, int workers);
 
 #endif
@@ -0,0 +1,265 @@
+#include "modes.h"
+#include "../include/alias.h"
+#include "../include/builtins.h"
+#include "../include/errors.h"
+#include "../include/jobs.h"
+#include "../include/readahead.h"
+#include "../include/stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Parallel batch mode (-j N). Each line is classified as it comes off the
+// readahead queue:
+//  - A line that touches shell state is a barrier: every running line
+//    finishes, then it runs in the shell itself. That is any line with a
+//    command that is an alias, a builtin that only works in the shell, or
+//    not a plain word, and any line that reads $?.
+//  - A line that redirects to a file an earlier line of the current region
+//    redirects to or names, or names a file one of them redirects to, waits
+//    for every running line and starts a new region.
+//  - Any other line runs in a forked copy of the shell as soon as one of the
+//    N workers is free.
+
+#define NAME_SET_INITIAL 64
+#define NAME_MAX_LEN 256
+
+// File names seen in the current region, compared as written
+typedef struct name_set {
+    char **names;
+    size_t cap;
+    size_t count;
+} name_set;
+
+typedef struct parallel {
+    int workers;
+    pid_t *pids;       // lines running now
+    long *seqs;        // their position among the lines started
+    int running;
+    long started;
+    long region_start; // lines started before the current region
+    int last_status;   // of the last line started, once it has finished
+    name_set written;  // redirect targets
+    name_set named;    // argument words
+} parallel;
+
+static size_t hash_name(const char *s, size_t len) {
+    size_t h = 5381;
+    for (size_t i = 0; i < len; i++) {
+        h = h * 33 + (unsigned char)s[i];
+    }
+    return h;
+}
+
+static char **name_slot(char **names, size_t cap, const char *s, size_t len) {
+    size_t i = hash_name(s, len) & (cap - 1);
+    while (names[i] && (strncmp(names[i], s, len) != 0 || names[i][len] != '\0')) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &names[i];
+}
+
+static int name_set_has(const name_set *set, const char *s, size_t len) {
+    return set->count > 0 && *name_slot(set->names, set->cap, s, len) != NULL;
+}
+
+static int name_set_add(name_set *set, const char *s, size_t len) {
+    // Keep the table at most half full
+    if ((set->count + 1) * 2 > set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : NAME_SET_INITIAL;
+        char **names = calloc(cap, sizeof(char *));
+        if (!names) return -1;
+        for (size_t i = 0; i < set->cap; i++) {
+            if (set->names[i]) {
+                *name_slot(names, cap, set->names[i], strlen(set->names[i])) = set->names[i];
+            }
+        }
+        free(set->names);
+        set->names = names;
+        set->cap = cap;
+    }
+
+    char **slot = name_slot(set->names, set->cap, s, len);
+    if (*slot) return 0;
+    *slot = strndup(s, len);
+    if (!*slot) return -1;
+    set->count++;
+    return 0;
+}
+
+static void name_set_clear(name_set *set) {
+    for (size_t i = 0; i < set->cap && set->count > 0; i++) {
+        if (set->names[i]) {
+            free(set->names[i]);
+            set->names[i] = NULL;
+            set->count--;
+        }
+    }
+}
+
+// The text of a word that is plain literal text, or NULL
+static const char *literal_word(const word *w, size_t *len) {
+    if (w->nsegs != 1 || w->segs[0].type != SEG_LITERAL) return NULL;
+    *len = w->segs[0].len;
+    return w->segs[0].text;
+}
+
+static int touches_state(const command_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        const command *cmd = &list->cmds[i];
+        for (int w = 0; w < cmd->argc; w++) {
+            for (int s = 0; s < cmd->words[w].nsegs; s++) {
+                if (cmd->words[w].segs[s].type == SEG_STATUS) return 1;
+            }
+        }
+        if (cmd->argc == 0) continue;
+
+        size_t len;
+        const char *text = literal_word(&cmd->words[0], &len);
+        char name[NAME_MAX_LEN];
+        if (!text || len >= sizeof(name)) return 1;
+        memcpy(name, text, len);
+        name[len] = '\0';
+        const builtin *b = find_builtin(name);
+        if ((b && (b->flags & BUILTIN_PARENT)) || find_alias(name)) return 1;
+    }
+    return 0;
+}
+
+static int conflicts(const parallel *p, const command_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        const command *cmd = &list->cmds[i];
+        if (cmd->redir_type == REDIR_OUT && cmd->redir_file) {
+            size_t len = strlen(cmd->redir_file);
+            if (name_set_has(&p->written, cmd->redir_file, len) ||
+                name_set_has(&p->named, cmd->redir_file, len)) {
+                return 1;
+            }
+        }
+        for (int w = 1; w < cmd->argc; w++) {
+            size_t len;
+            const char *text = literal_word(&cmd->words[w], &len);
+            if (text && name_set_has(&p->written, text, len)) return 1;
+        }
+    }
+    return 0;
+}
+
+static int remember_names(parallel *p, const command_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        const command *cmd = &list->cmds[i];
+        if (cmd->redir_type == REDIR_OUT && cmd->redir_file &&
+            name_set_add(&p->written, cmd->redir_file, strlen(cmd->redir_file)) < 0) {
+            return -1;
+        }
+        for (int w = 1; w < cmd->argc; w++) {
+            size_t len;
+            const char *text = literal_word(&cmd->words[w], &len);
+            if (text && name_set_add(&p->named, text, len) < 0) return -1;
+        }
+    }
+    return 0;
+}
+
+static void wait_one(parallel *p) {
+    int status;
+    pid_t pid = wait_any_child(p->pids, p->running, &status);
+    if (pid < 0) {
+        // Nothing left to wait for; do not spin on the same lines
+        p->running = 0;
+        return;
+    }
+    for (int k = 0; k < p->running; k++) {
+        if (p->pids[k] != pid) continue;
+        if (p->seqs[k] == p->started) {
+            p->last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        }
+        p->running--;
+        p->pids[k] = p->pids[p->running];
+        p->seqs[k] = p->seqs[p->running];
+        return;
+    }
+}
+
+// Let every running line finish. $? is then the status of the region's last
+// line, as if the lines had run one after another.
+static void drain(parallel *p) {
+    while (p->running > 0) wait_one(p);
+    if (p->started > p->region_start) shell->exit_status = p->last_status;
+    p->region_start = p->started;
+    name_set_clear(&p->written);
+    name_set_clear(&p->named);
+}
+
+static void start_line(parallel *p, command_list *cmds) {
+    if (p->running == p->workers) wait_one(p);
+
+    // Otherwise output still buffered in the shell would be written twice
+    fflush(shell->out);
+    fflush(shell->err);
+    pid_t pid = fork();
+    if (pid == 0) {
+        jobs_child_reset();
+        int status = execute_sequence(cmds);
+        fflush(shell->out);
+        fflush(shell->err);
+        trace_close();
+        _exit(status);
+    }
+
+    p->started++;
+    if (pid < 0) {
+        // The line does not depend on the running ones; run it here instead
+        p->last_status = execute_sequence(cmds);
+        return;
+    }
+    stats.forks++;
+    p->pids[p->running] = pid;
+    p->seqs[p->running] = p->started;
+    p->running++;
+}
+
+void batch_parallel(readahead *ra, int workers) {
+    parallel p;
+    memset(&p, 0, sizeof(p));
+    p.workers = workers;
+    p.pids = malloc(workers * sizeof(pid_t));
+    p.seqs = malloc(workers * sizeof(long));
+    if (!p.pids || !p.seqs) {
+        // Fall back to running every line in order
+        print_error();
+        p.workers = 0;
+    }
+
+    command_list *cmds;
+    readahead_status status;
+    while ((status = readahead_next(ra, &cmds)) != READAHEAD_EOF) {
+        if (status == READAHEAD_ERROR) {
+            print_error();
+            continue;
+        }
+        trace_current = ra->current;
+        if (p.workers == 0 || touches_state(cmds)) {
+            drain(&p);
+            execute_sequence(cmds);
+        } else {
+            if (conflicts(&p, cmds)) drain(&p);
+            if (remember_names(&p, cmds) < 0) {
+                print_error();
+                drain(&p);
+                execute_sequence(cmds);
+            } else {
+                start_line(&p, cmds);
+            }
+        }
+        free_commands(cmds);
+    }
+    drain(&p);
+
+    free(p.pids);
+    free(p.seqs);
+    free(p.written.names);
+    free(p.named.names);
+}
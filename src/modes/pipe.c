@@ -1,15 +1,29 @@
 #include "modes.h"
+#include "../include/errors.h"
+#include "../include/readahead.h"
 #include "../include/utils.h"
 #include "../include/shell.h"
 #include <stdio.h>
+#include <unistd.h>
 
 void pipe_mode(void) {
-    char *line;
-    while ((line = read_line(stdin)) != NULL) {
-        command *cmds = parse_line(line);
-        if (cmds) {
-            execute_sequence(cmds);
-            free_commands(cmds);
+    line_reader *reader = reader_open(STDIN_FILENO);
+    if (!reader) return;
+    
+    readahead ra;
+    readahead_start(&ra, reader);
+    
+    command_list *cmds;
+    readahead_status status;
+    while ((status = readahead_next(&ra, &cmds)) != READAHEAD_EOF) {
+        if (status == READAHEAD_ERROR) {
+            print_error();
+            continue;
         }
+        trace_current = ra.current;
+        execute_sequence(cmds);
+        free_commands(cmds);
     }
+    readahead_stop(&ra);
+    reader_close(reader);
 }
@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+#include "modes.h"
+#include "../include/serve.h"
+#include "../include/errors.h"
+#include "../include/events.h"
+#include "../include/jobs.h"
+#include "../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// Server mode (--serve SOCKET). The server keeps a pool of forked workers
+// blocked in accept(). Each worker serves exactly one connection, as one
+// session, and exits; the server forks a replacement as soon as it does.
+// Every session therefore starts from the server's startup state and its
+// cwd, variables, aliases and $? die with it, while the fork itself happens
+// before the client connects.
+
+#define SERVE_BACKLOG 128
+
+// The request being served, so the `exit` builtin can still answer it
+static int session_fd = -1;
+static int in_request = 0;
+static int capture;
+static int capture_fd[2] = {-1, -1}; // stdout, stderr
+static int saved_fd[3] = {-1, -1, -1};
+
+static int recv_request(int sock, serve_request *req, int *fds, int *nfds) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = {req, sizeof(*req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)sizeof(*req)) return -1;
+
+    *nfds = 0;
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (c && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        *nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(c), *nfds * sizeof(int));
+    }
+    return 0;
+}
+
+static int send_frame(serve_frame_type type, const void *data, uint32_t len) {
+    serve_frame frame = {type, len};
+    if (send_full(session_fd, &frame, sizeof(frame)) < 0) return -1;
+    return send_full(session_fd, data, len);
+}
+
+// Point stdin, stdout and stderr at the request's fds, or at /dev/null and
+// the capture files
+static int begin_request(const serve_request *req, int *fds, int nfds) {
+    int target[3] = {-1, -1, -1};
+    capture = (req->flags & SERVE_CAPTURE) != 0;
+    if (capture) {
+        capture_fd[0] = memfd_create("stdout", MFD_CLOEXEC);
+        capture_fd[1] = memfd_create("stderr", MFD_CLOEXEC);
+        target[1] = capture_fd[0];
+        target[2] = capture_fd[1];
+    } else if (nfds == 3) {
+        memcpy(target, fds, sizeof(target));
+    }
+    int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    for (int i = 0; i < 3; i++) {
+        if (target[i] < 0) target[i] = devnull;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    int status = 0;
+    for (int i = 0; i < 3; i++) {
+        saved_fd[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+        if (target[i] < 0 || dup2(target[i], i) < 0) status = -1;
+    }
+    if (devnull >= 0) close(devnull);
+    for (int i = 0; i < nfds; i++) close(fds[i]);
+    return status;
+}
+
+static int send_captured(int fd, serve_frame_type type) {
+    char buf[SERVE_CHUNK];
+    if (fd < 0 || lseek(fd, 0, SEEK_SET) < 0) return 0;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (send_frame(type, buf, n) < 0) return -1;
+    }
+    return 0;
+}
+
+// Put the worker's own stdio back and send the output and status
+static int end_request(int status) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        if (saved_fd[i] < 0) continue;
+        dup2(saved_fd[i], i);
+        close(saved_fd[i]);
+        saved_fd[i] = -1;
+    }
+    in_request = 0;
+
+    int rc = 0;
+    if (capture) {
+        if (send_captured(capture_fd[0], SERVE_STDOUT) < 0 ||
+            send_captured(capture_fd[1], SERVE_STDERR) < 0) {
+            rc = -1;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (capture_fd[i] >= 0) close(capture_fd[i]);
+            capture_fd[i] = -1;
+        }
+    }
+    int32_t value = status;
+    if (rc == 0) rc = send_frame(SERVE_STATUS, &value, sizeof(value));
+    return rc;
+}
+
+// `exit` ends the session, but its line still gets its answer
+static void session_at_exit(void) {
+    if (in_request) end_request(shell->exit_status);
+}
+
+static void serve_session(int conn) {
+    session_fd = conn;
+    atexit(session_at_exit);
+
+    serve_request req;
+    int fds[3];
+    int nfds;
+    while (recv_request(conn, &req, fds, &nfds) == 0) {
+        char *line = req.len <= SERVE_MAX_LINE ? malloc(req.len ? req.len : 1) : NULL;
+        if (!line || read_full(conn, line, req.len) < 0) break;
+
+        in_request = 1;
+        int status = 1;
+        if (begin_request(&req, fds, nfds) == 0) {
+            int error;
+            command_list *cmds = parse_line_cached(line, req.len, &error);
+            if (error) {
+                print_error();
+            } else {
+                status = cmds ? execute_sequence(cmds) : 0;
+            }
+            free_commands(cmds);
+        }
+        free(line);
+        if (end_request(status) < 0) break;
+    }
+}
+
+static pid_t start_worker(int listen_fd, pid_t server) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    jobs_child_reset();
+
+    // An idle worker goes away with the server; a busy one finishes its
+    // session first
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != server) _exit(0);
+    int conn;
+    do {
+        conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    } while (conn < 0 && errno == EINTR);
+    prctl(PR_SET_PDEATHSIG, 0);
+    close(listen_fd);
+    if (conn < 0) _exit(1);
+
+    serve_session(conn);
+    fflush(stdout);
+    trace_close();
+    _exit(0);
+}
+
+static int serve_listen(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+
+    // A socket left behind by an earlier server is replaced; anything else
+    // at the path is an error
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, SERVE_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Serve sessions until interrupted. `workers` sessions (default: the
+// background job limit) are served at once.
+void serve_mode(const char *path, int workers) {
+    if (workers <= 0) workers = jobs_get_limit();
+    int listen_fd = serve_listen(path);
+    pid_t *pool = calloc(workers, sizeof(pid_t));
+    if (listen_fd < 0 || !pool) {
+        print_error();
+        exit(1);
+    }
+
+    pid_t server = getpid();
+    for (int i = 0; i < workers; i++) {
+        pool[i] = start_worker(listen_fd, server);
+    }
+
+    while (1) {
+        int events = events_wait(-1, -1);
+        if (events < 0 || (events & EVENT_INTERRUPT)) break;
+        if (!(events & EVENT_CHILD)) continue;
+
+        pid_t pid;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < workers; i++) {
+                if (pool[i] == pid) pool[i] = start_worker(listen_fd, server);
+            }
+        }
+        // Workers that could not be forked are retried with the next exit
+        for (int i = 0; i < workers; i++) {
+            if (pool[i] < 0) pool[i] = start_worker(listen_fd, server);
+        }
+    }
+
+    for (int i = 0; i < workers; i++) {
+        if (pool[i] > 0) kill(pool[i], SIGTERM);
+    }
+    close(listen_fd);
+    unlink(path);
+    free(pool);
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Long-line checks for the growable command and argv vectors: a line with
+# 1e5 arguments must reach the command whole, and doubling a line's length
+# must not much more than double the time it takes to parse and expand.
+# Usage: tests/scaling.sh [path-to-oshell]
+
+shell=${1:-./oshell}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+fail=0
+
+# Words w0 .. w<n-1> after `prefix`, on one line
+line() {
+    awk -v n="$2" -v p="$1" 'BEGIN { printf "%s", p; for (i = 0; i < n; i++) printf " w%d", i; printf "\n" }'
+}
+
+line echo 100000 > "$tmp/args"
+got=$("$shell" "$tmp/args" | wc -w | tr -d ' ')
+if [ "$got" = 100000 ]; then
+    echo "ok: 100000 arguments"
+else
+    echo "FAIL: 100000 arguments, got '$got'"
+    fail=1
+fi
+
+# The command does not exist, so each line costs its parse, expansion and
+# one lookup; four copies keep startup out of the ratio. Best of three.
+elapsed() {
+    best=
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "$shell" "$1" > /dev/null 2>&1
+        end=$(date +%s%N)
+        t=$(( (end - start) / 1000 ))
+        if [ -z "$best" ] || [ "$t" -lt "$best" ]; then best=$t; fi
+    done
+    echo "$best"
+}
+
+for n in 100000 200000; do
+    line oshell-check-no-such-command "$n" > "$tmp/one"
+    cat "$tmp/one" "$tmp/one" "$tmp/one" "$tmp/one" > "$tmp/line$n"
+done
+t1=$(elapsed "$tmp/line100000")
+t2=$(elapsed "$tmp/line200000")
+echo "1e5 words: ${t1} us, 2e5 words: ${t2} us"
+if [ $((t2 * 10)) -le $((t1 * 30)) ]; then
+    echo "ok: 2e5 words within 3x of 1e5"
+else
+    echo "FAIL: 2e5 words took more than 3x 1e5"
+    fail=1
+fi
+
+exit $fail
@@ -0,0 +1,57 @@
+// Build-time generator for the builtin lookup table. Finds a seed for
+// builtin_name_hash() that gives every name in builtins.def its own slot in the
+// smallest power-of-two table it can, and prints the result as a header.
+#include "builtins.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *names[] = {
+#define BUILTIN(name, flags) #name,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+#define NAME_COUNT ((int)(sizeof(names) / sizeof(names[0])))
+#define MAX_SIZE 4096
+#define SEEDS_PER_SIZE 1000000u
+
+static int slots[MAX_SIZE];
+
+static int try_seed(unsigned int seed, unsigned int size) {
+    for (unsigned int s = 0; s < size; s++) slots[s] = -1;
+    for (int i = 0; i < NAME_COUNT; i++) {
+        unsigned int s = builtin_name_hash(names[i], seed) & (size - 1);
+        if (slots[s] >= 0) return 0;
+        slots[s] = i;
+    }
+    return 1;
+}
+
+int main(void) {
+    if (NAME_COUNT > 127) {
+        fprintf(stderr, "gen_builtin_hash: too many builtins for the slot table\n");
+        return 1;
+    }
+
+    unsigned int size = 1;
+    while (size < (unsigned int)NAME_COUNT) size *= 2;
+
+    for (; size <= MAX_SIZE; size *= 2) {
+        for (unsigned int seed = 2166136261u, n = 0; n < SEEDS_PER_SIZE; seed++, n++) {
+            if (!try_seed(seed, size)) continue;
+
+            printf("// Generated by tools/gen_builtin_hash.c from builtins.def; do not edit.\n");
+            printf("#define BUILTIN_HASH_SEED %uu\n", seed);
+            printf("#define BUILTIN_HASH_SIZE %u\n\n", size);
+            printf("// Slot -> index into the registry, or -1\n");
+            printf("static const signed char builtin_slots[BUILTIN_HASH_SIZE] = {");
+            for (unsigned int s = 0; s < size; s++) {
+                printf("%s%d", s % 16 ? ", " : "\n    ", slots[s]);
+            }
+            printf("\n};\n");
+            return 0;
+        }
+    }
+    fprintf(stderr, "gen_builtin_hash: no perfect hash found\n");
+    return 1;
+}